@@ -0,0 +1,280 @@
+/*
+ * Fixed size arena for urngd's working memory and secrets.
+ *
+ * The arena is a single mapping set up on first use: excluded from core
+ * dumps, wiped in forked children and fenced by inaccessible guard pages on
+ * both ends. Pages are locked, so they are never swapped out, as they are
+ * handed out: room reserved for a buffer that ends up unused costs no RAM.
+ * With URNGD_STATIC_ALLOC the arena is a static array instead, sized at
+ * compile time for the main collector and the most boot phase workers with
+ * the default memory access buffer, and locked as a whole on first use.
+ *
+ * Allocations are few, long lived and, when the collector is reallocated
+ * after a failure, of the very same sizes again. So a handful of slots
+ * handed out first fit is all that's needed. Besides the fixed ARENA_SIZE
+ * for the pool and collection buffers, room for the collectors is reserved
+ * before first use, once their count and memory access buffer size are
+ * known. The collector's own allocations are routed here at compile time,
+ * so nothing on the injection path touches the heap. The self-test thread
+ * may allocate as well, so allocations are serialized.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "arena.h"
+#include "workers.h"
+
+#define ARENA_SLOTS 8
+
+#ifndef MADV_WIPEONFORK
+#define MADV_WIPEONFORK 18
+#endif
+
+struct arena_slot {
+	size_t off;
+	size_t len;
+	bool used;
+};
+
+#ifdef URNGD_STATIC_ALLOC
+/* the main collector takes 2 allocations, see urngd_reserve() */
+#define ARENA_STATIC_SLOTS (ARENA_SLOTS + 2 + WORKERS_MAX * WORKER_ARENA_SLOTS)
+#define ARENA_STATIC_SIZE \
+	(ARENA_ROUND(ARENA_STATIC_SLOTS * sizeof(struct arena_slot)) + \
+	 ARENA_SIZE + ARENA_COLLECTOR + WORKERS_MAX * WORKER_ARENA)
+#define ARENA_STATIC_PAGE 4096
+
+/* whole pages, so that nothing else shares the locked ones */
+static unsigned char arena_static[(ARENA_STATIC_SIZE + ARENA_STATIC_PAGE - 1) &
+				  ~(ARENA_STATIC_PAGE - 1)]
+	__attribute__((aligned(ARENA_STATIC_PAGE)));
+#endif
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char *arena_map;
+static size_t arena_maplen;
+static unsigned char *arena_mem;
+static size_t arena_size = ARENA_SIZE;
+/* the slot table sits in front of arena_mem, inside the locked mapping */
+static struct arena_slot *arena_slots;
+static unsigned int arena_maxslots = ARENA_SLOTS;
+static unsigned int arena_nslots;
+static size_t arena_top;
+
+/*
+ * Room for len more bytes in up to slots allocations, each rounded with
+ * ARENA_ROUND() by the caller. Only possible before first use.
+ */
+bool arena_reserve(size_t len, unsigned int slots)
+{
+	if (arena_map) {
+		ERROR("arena already in use, cannot reserve %zub\n", len);
+		return false;
+	}
+
+	arena_size += len;
+	arena_maxslots += slots;
+
+	return true;
+}
+
+#ifdef URNGD_STATIC_ALLOC
+static bool arena_init(void)
+{
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	size_t table = ARENA_ROUND(arena_maxslots * sizeof(*arena_slots));
+	uintptr_t start, end;
+
+	if (table + arena_size > sizeof(arena_static)) {
+		ERROR("arena of %zub exceeds the static %zub\n",
+		      table + arena_size, sizeof(arena_static));
+		return false;
+	}
+
+	arena_map = arena_static;
+	arena_maplen = sizeof(arena_static);
+
+	if (mlock(arena_map, arena_maplen))
+		ERROR("arena mlock failed: %s\n", strerror(errno));
+
+	/* with bigger pages, only those wholly inside the array */
+	start = ((uintptr_t)arena_map + page - 1) & ~(page - 1);
+	end = ((uintptr_t)arena_map + arena_maplen) & ~(page - 1);
+	if (end > start) {
+		if (madvise((void *)start, end - start, MADV_DONTDUMP))
+			ERROR("arena MADV_DONTDUMP failed: %s\n", strerror(errno));
+		if (madvise((void *)start, end - start, MADV_WIPEONFORK))
+			ERROR("arena MADV_WIPEONFORK failed: %s\n", strerror(errno));
+	}
+
+	arena_slots = (struct arena_slot *)arena_map;
+	arena_mem = arena_map + table;
+
+	return true;
+}
+#else
+static bool arena_init(void)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t table = ARENA_ROUND(arena_maxslots * sizeof(*arena_slots));
+	size_t len = (table + arena_size + page - 1) & ~(page - 1);
+
+	arena_maplen = len + 2 * page;
+	arena_map = mmap(NULL, arena_maplen, PROT_NONE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (arena_map == MAP_FAILED) {
+		ERROR("arena mmap failed: %s\n", strerror(errno));
+		arena_map = NULL;
+		return false;
+	}
+
+	if (mprotect(arena_map + page, len, PROT_READ | PROT_WRITE)) {
+		ERROR("arena mprotect failed: %s\n", strerror(errno));
+		munmap(arena_map, arena_maplen);
+		arena_map = NULL;
+		return false;
+	}
+
+	if (mlock(arena_map + page, table))
+		ERROR("arena mlock failed: %s\n", strerror(errno));
+	if (madvise(arena_map + page, len, MADV_DONTDUMP))
+		ERROR("arena MADV_DONTDUMP failed: %s\n", strerror(errno));
+	if (madvise(arena_map + page, len, MADV_WIPEONFORK))
+		ERROR("arena MADV_WIPEONFORK failed: %s\n", strerror(errno));
+
+	arena_slots = (struct arena_slot *)(arena_map + page);
+	arena_mem = arena_map + page + table;
+
+	return true;
+}
+#endif
+
+/* zeroed memory, like the collector's jent_zalloc() */
+void *arena_alloc(size_t len)
+{
+	struct arena_slot *s = NULL;
+	void *p = NULL;
+	unsigned int i;
+
+	pthread_mutex_lock(&arena_lock);
+
+	if (!arena_mem && !arena_init())
+		goto out;
+
+	len = ARENA_ROUND(len);
+
+	for (i = 0; i < arena_nslots; i++) {
+		if (!arena_slots[i].used && arena_slots[i].len >= len) {
+			s = &arena_slots[i];
+			break;
+		}
+	}
+
+	if (!s) {
+		if (arena_nslots == arena_maxslots || arena_size - arena_top < len) {
+			ERROR("arena exhausted allocating %zub\n", len);
+			goto out;
+		}
+
+		s = &arena_slots[arena_nslots++];
+		s->off = arena_top;
+		s->len = len;
+		arena_top += len;
+
+#ifndef URNGD_STATIC_ALLOC
+		if (mlock(arena_mem + s->off, len))
+			ERROR("arena mlock failed: %s\n", strerror(errno));
+#endif
+	}
+
+	s->used = true;
+	p = arena_mem + s->off;
+	memset(p, 0, s->len);
+
+out:
+	pthread_mutex_unlock(&arena_lock);
+
+	return p;
+}
+
+void arena_free(void *p)
+{
+	bool found = false;
+	unsigned int i;
+
+	if (!p)
+		return;
+
+	pthread_mutex_lock(&arena_lock);
+
+	for (i = 0; arena_mem && i < arena_nslots; i++) {
+		if (arena_mem + arena_slots[i].off != p)
+			continue;
+
+		memset(p, 0, arena_slots[i].len);
+		__asm__ __volatile__("" : : "r" (p) : "memory");
+		arena_slots[i].used = false;
+		found = true;
+		break;
+	}
+
+	pthread_mutex_unlock(&arena_lock);
+
+	if (!found)
+		ERROR("arena_free of foreign pointer %p\n", p);
+}
+
+static unsigned long arena_rss_kb(void)
+{
+	unsigned long rss = 0;
+	char line[128];
+	FILE *fp;
+
+	fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return 0;
+
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "VmRSS: %lu kB", &rss) == 1)
+			break;
+
+	fclose(fp);
+
+	return rss;
+}
+
+void arena_report(void)
+{
+	LOG("arena: %zu of %zu bytes in %u of %u slots, rss %lu kB\n",
+	    arena_top, arena_size, arena_nslots, arena_maxslots, arena_rss_kb());
+}
+
+void arena_done(void)
+{
+	if (!arena_map)
+		return;
+
+	memset(arena_mem, 0, arena_size);
+	__asm__ __volatile__("" : : "r" (arena_mem) : "memory");
+#ifdef URNGD_STATIC_ALLOC
+	munlock(arena_map, arena_maplen);
+#else
+	munmap(arena_map, arena_maplen);
+#endif
+	arena_map = arena_mem = NULL;
+	arena_slots = NULL;
+	arena_size = ARENA_SIZE;
+	arena_maxslots = ARENA_SLOTS;
+	arena_nslots = 0;
+	arena_top = 0;
+}
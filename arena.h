@@ -0,0 +1,30 @@
+/*
+ * Fixed size arena for urngd's working memory and secrets.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "jitterentropy.h"
+
+/* the pool and collection buffers and the seed scratch, collectors reserve */
+#define ARENA_SIZE 2048
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(len) (((len) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/* what jent_entropy_collector_alloc() takes in 2 allocations, buffer included */
+#define ARENA_COLLECTOR \
+	(ARENA_ROUND(sizeof(struct rand_data)) + ARENA_ROUND(JENT_MEMORY_SIZE))
+
+bool arena_reserve(size_t len, unsigned int slots);
+void *arena_alloc(size_t len);
+void arena_free(void *p);
+void arena_report(void);
+void arena_done(void);
+
+#endif
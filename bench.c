@@ -0,0 +1,445 @@
+/*
+ * urngd-bench - collection and injection throughput benchmark.
+ *
+ * Runs the jitter collector in a couple of configurations and prints the
+ * results as JSON, one configuration per line. With -c the results are
+ * compared against an earlier run and regressions beyond the threshold are
+ * listed and reflected in the exit code. With -R the collector additionally
+ * runs on a recorded timing trace instead of the timer, which gives a
+ * throughput and an output digest that are reproducible on any machine.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <linux/random.h>
+
+#include "log.h"
+#include "arena.h"
+#include "noise.h"
+#include "jitterentropy.h"
+
+#define BENCH_BLOCK 64
+#define BENCH_SECONDS 2
+#define BENCH_THRESHOLD 10
+#define BENCH_CONFIGS_MAX 8
+#define BENCH_REGRESSIONS_MAX 32
+#define BENCH_NAME 32
+#define BENCH_METRIC 32
+/* "<name>: <metric> <n>% worse" */
+#define BENCH_REGRESSION (BENCH_NAME + BENCH_METRIC + 32)
+#define BENCH_DIGEST_BYTES 4096
+
+#ifdef URNGD_DEBUG
+unsigned int debug;
+#endif
+
+struct bench_config {
+	const char *name;
+	unsigned int osr;
+	unsigned int flags;
+};
+
+struct bench_result {
+	char name[BENCH_NAME];
+	unsigned int osr;
+	unsigned int flags;
+	double bytes_per_sec;
+	double cpu_sec_per_credited_kbit;
+	unsigned long rss_kb;
+};
+
+static const struct bench_config bench_configs[] = {
+	{ "default", 1, 0 },
+	{ "osr2", 2, 0 },
+	{ "nomem", 1, JENT_DISABLE_MEMORY_ACCESS },
+};
+
+#define BENCH_NCONFIGS (sizeof(bench_configs) / sizeof(bench_configs[0]))
+
+static double bench_time(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long bench_rss_kb(void)
+{
+	unsigned long rss = 0;
+	char line[128];
+	FILE *fp;
+
+	fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return 0;
+
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "VmRSS: %lu kB", &rss) == 1)
+			break;
+
+	fclose(fp);
+
+	return rss;
+}
+
+static bool bench_collect(const struct bench_config *c, unsigned int seconds,
+			  unsigned int margin, struct bench_result *r)
+{
+	char buf[BENCH_BLOCK];
+	struct rand_data *ec;
+	double start, cpu, end;
+	unsigned int credit;
+	size_t bytes = 0;
+
+	ec = jent_entropy_collector_alloc(c->osr, c->flags);
+	if (!ec) {
+		ERROR("%s: jent-rng alloc failed\n", c->name);
+		return false;
+	}
+
+	/* estimated on this configuration, e.g. without the memory access loop */
+	credit = noise_credit_rate(ec, NULL, c->osr, margin);
+
+	cpu = bench_time(CLOCK_PROCESS_CPUTIME_ID);
+	start = bench_time(CLOCK_MONOTONIC);
+	do {
+		if (jent_read_entropy(ec, buf, sizeof(buf)) < 0) {
+			ERROR("%s: cannot read entropy\n", c->name);
+			jent_entropy_collector_free(ec);
+			return false;
+		}
+		bytes += sizeof(buf);
+		end = bench_time(CLOCK_MONOTONIC);
+	} while (end - start < seconds);
+	cpu = bench_time(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+	snprintf(r->name, sizeof(r->name), "%s", c->name);
+	r->osr = c->osr;
+	r->flags = c->flags;
+	r->bytes_per_sec = bytes / (end - start);
+	r->cpu_sec_per_credited_kbit = credit ?
+		cpu / (bytes * 8.0 * credit / 1000 / 1000) : 0;
+	r->rss_kb = bench_rss_kb();
+
+	memset(buf, 0, sizeof(buf));
+	jent_entropy_collector_free(ec);
+
+	return true;
+}
+
+/*
+ * Uncredited injections per second, through RNDADDENTROPY when permitted
+ * and through write() otherwise.
+ */
+static double bench_inject(unsigned int seconds, const char **method)
+{
+	char pool[sizeof(struct rand_pool_info) + BENCH_BLOCK] = { 0 };
+	struct rand_pool_info *rpi = (struct rand_pool_info *)pool;
+	double start, end;
+	unsigned long calls = 0;
+	bool use_ioctl = true;
+	int fd, ret;
+
+	fd = open("/dev/random", O_WRONLY);
+	if (fd < 0) {
+		ERROR("/dev/random open failed: %s\n", strerror(errno));
+		return 0;
+	}
+
+	rpi->buf_size = BENCH_BLOCK;
+	*method = "ioctl";
+
+	start = end = bench_time(CLOCK_MONOTONIC);
+	do {
+		if (use_ioctl) {
+			ret = ioctl(fd, RNDADDENTROPY, rpi);
+			if (ret < 0 && errno == EPERM) {
+				use_ioctl = false;
+				*method = "write";
+				continue;
+			}
+		} else {
+			ret = write(fd, rpi->buf, BENCH_BLOCK);
+		}
+
+		if (ret < 0) {
+			ERROR("injection failed: %s\n", strerror(errno));
+			break;
+		}
+
+		calls++;
+		end = bench_time(CLOCK_MONOTONIC);
+	} while (end - start < seconds);
+
+	close(fd);
+
+	return calls ? calls / (end - start) : 0;
+}
+
+/*
+ * Collector throughput over a replayed trace. The collector's timer reads
+ * take the recorded deltas, so the digest (FNV-1a) of the first output
+ * bytes only depends on the trace and on jitterentropy-base.c.
+ */
+static double bench_replay(const char *trace, unsigned int seconds,
+			   uint64_t *digest)
+{
+	unsigned char buf[BENCH_BLOCK];
+	uint64_t h = 0xcbf29ce484222325ULL;
+	struct rand_data *ec;
+	double start, end;
+	size_t bytes = 0, i;
+
+	if (!noise_replay_open(trace))
+		return 0;
+
+	ec = jent_entropy_collector_alloc(1, 0);
+	if (!ec) {
+		ERROR("%s: jent-rng alloc failed\n", trace);
+		noise_replay_close();
+		return 0;
+	}
+
+	for (bytes = 0; bytes < BENCH_DIGEST_BYTES; bytes += sizeof(buf)) {
+		if (jent_read_entropy(ec, (char *)buf, sizeof(buf)) < 0) {
+			ERROR("%s: cannot read entropy\n", trace);
+			jent_entropy_collector_free(ec);
+			noise_replay_close();
+			return 0;
+		}
+		for (i = 0; i < sizeof(buf); i++)
+			h = (h ^ buf[i]) * 0x100000001b3ULL;
+	}
+	*digest = h;
+
+	bytes = 0;
+	start = end = bench_time(CLOCK_MONOTONIC);
+	do {
+		if (jent_read_entropy(ec, (char *)buf, sizeof(buf)) < 0)
+			break;
+		bytes += sizeof(buf);
+		end = bench_time(CLOCK_MONOTONIC);
+	} while (end - start < seconds);
+
+	memset(buf, 0, sizeof(buf));
+	jent_entropy_collector_free(ec);
+	noise_replay_close();
+
+	return bytes ? bytes / (end - start) : 0;
+}
+
+static size_t bench_load(const char *path, struct bench_result *r,
+			 size_t max, double *inject, double *replay)
+{
+	char line[512];
+	size_t n = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		ERROR("cannot open %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		sscanf(line, " \"injection_syscalls_per_sec\": %lf", inject);
+		sscanf(line, " \"replay_bytes_per_sec\": %lf", replay);
+
+		if (n < max &&
+		    sscanf(line, " { \"name\": \"%31[^\"]\", \"osr\": %u, "
+			   "\"flags\": %u, \"bytes_per_sec\": %lf, "
+			   "\"cpu_sec_per_credited_kbit\": %lf, "
+			   "\"rss_kb\": %lu",
+			   r[n].name, &r[n].osr, &r[n].flags,
+			   &r[n].bytes_per_sec, &r[n].cpu_sec_per_credited_kbit,
+			   &r[n].rss_kb) == 6)
+			n++;
+	}
+
+	fclose(fp);
+
+	return n;
+}
+
+/* relative change of cur against base in percent, positive is worse */
+static double bench_worse(double base, double cur, bool higher_is_better)
+{
+	if (base <= 0)
+		return 0;
+
+	return (higher_is_better ? base - cur : cur - base) * 100 / base;
+}
+
+static unsigned int bench_compare(const char *path, struct bench_result *r,
+				  size_t n, double inject, double replay,
+				  double threshold, char regs[][BENCH_REGRESSION])
+{
+	struct bench_result base[BENCH_CONFIGS_MAX];
+	double base_inject = 0, base_replay = 0, d;
+	unsigned int nregs = 0;
+	size_t i, j, nbase;
+
+	nbase = bench_load(path, base, BENCH_CONFIGS_MAX, &base_inject,
+			   &base_replay);
+
+#define BENCH_CHECK(what, metric, b, c, better) do { \
+	d = bench_worse(b, c, better); \
+	if (d > threshold && nregs < BENCH_REGRESSIONS_MAX) \
+		snprintf(regs[nregs++], sizeof(regs[0]), \
+			 "%.*s: %.*s %.1f%% worse", BENCH_NAME - 1, what, \
+			 BENCH_METRIC - 1, metric, d); \
+	} while (0)
+
+	BENCH_CHECK("injection", "syscalls_per_sec", base_inject, inject, true);
+	if (replay)
+		BENCH_CHECK("replay", "bytes_per_sec", base_replay, replay, true);
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < nbase; j++)
+			if (!strcmp(r[i].name, base[j].name))
+				break;
+
+		if (j == nbase)
+			continue;
+
+		BENCH_CHECK(r[i].name, "bytes_per_sec", base[j].bytes_per_sec,
+			    r[i].bytes_per_sec, true);
+		BENCH_CHECK(r[i].name, "cpu_sec_per_credited_kbit",
+			    base[j].cpu_sec_per_credited_kbit,
+			    r[i].cpu_sec_per_credited_kbit, false);
+		BENCH_CHECK(r[i].name, "rss_kb", base[j].rss_kb, r[i].rss_kb,
+			    false);
+	}
+
+#undef BENCH_CHECK
+
+	return nregs;
+}
+
+static void bench_print(struct bench_result *r, size_t n, double inject,
+			const char *method, double replay, uint64_t digest,
+			char regs[][BENCH_REGRESSION], unsigned int nregs, bool compared)
+{
+	unsigned int i;
+
+	printf("{\n");
+	printf("  \"version\": \"%s\",\n", URNGD_VERSION);
+	printf("  \"injection_syscalls_per_sec\": %.1f,\n", inject);
+	printf("  \"injection_method\": \"%s\",\n", method);
+	if (replay) {
+		printf("  \"replay_bytes_per_sec\": %.1f,\n", replay);
+		printf("  \"replay_digest\": \"%016llx\",\n",
+		       (unsigned long long)digest);
+	}
+	printf("  \"configs\": [\n");
+	for (i = 0; i < n; i++)
+		printf("    { \"name\": \"%s\", \"osr\": %u, \"flags\": %u, "
+		       "\"bytes_per_sec\": %.1f, "
+		       "\"cpu_sec_per_credited_kbit\": %.6f, "
+		       "\"rss_kb\": %lu }%s\n",
+		       r[i].name, r[i].osr, r[i].flags, r[i].bytes_per_sec,
+		       r[i].cpu_sec_per_credited_kbit, r[i].rss_kb,
+		       i + 1 < n ? "," : "");
+	printf("  ]%s\n", compared ? "," : "");
+
+	if (compared) {
+		printf("  \"regressions\": [");
+		for (i = 0; i < nregs; i++)
+			printf("%s\n    \"%s\"", i ? "," : "", regs[i]);
+		printf("%s]\n", nregs ? "\n  " : "");
+	}
+
+	printf("}\n");
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-c <file>	Compare against the JSON of an earlier run\n"
+		"	-m <percent>	Safety margin used for crediting (default 50)\n"
+		"	-R <file>	Also benchmark the collector on a trace recorded with urngd -r\n"
+		"	-t <seconds>	Duration of each measurement (default %d)\n"
+		"	-T <percent>	Regression threshold (default %d)\n"
+		"\n", prog, BENCH_SECONDS, BENCH_THRESHOLD);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_result r[BENCH_CONFIGS_MAX];
+	char regs[BENCH_REGRESSIONS_MAX][BENCH_REGRESSION];
+	unsigned int seconds = BENCH_SECONDS;
+	double threshold = BENCH_THRESHOLD;
+	unsigned int margin = 50;
+	unsigned int nregs = 0;
+	const char *method = "none";
+	const char *compare = NULL;
+	const char *trace = NULL;
+	double inject, replay = 0;
+	uint64_t digest = 0;
+	size_t i, n = 0;
+	int ch, ret;
+
+	while ((ch = getopt(argc, argv, "c:m:R:t:T:")) != -1) {
+		switch (ch) {
+		case 'c':
+			compare = optarg;
+			break;
+		case 'm':
+			margin = atoi(optarg);
+			break;
+		case 'R':
+			trace = optarg;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'T':
+			threshold = atof(optarg);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	ulog_open(ULOG_STDIO, LOG_USER, "urngd-bench");
+
+	/* one collector at a time, served from the arena like urngd's */
+	arena_reserve(ARENA_COLLECTOR, 2);
+
+	ret = jent_entropy_init();
+	if (ret) {
+		ERROR("jent-rng init failed, err: %d\n", ret);
+		return 1;
+	}
+
+	for (i = 0; i < BENCH_NCONFIGS; i++)
+		if (bench_collect(&bench_configs[i], seconds, margin, &r[n]))
+			n++;
+
+	inject = bench_inject(seconds, &method);
+
+	if (trace)
+		replay = bench_replay(trace, seconds, &digest);
+
+	if (compare)
+		nregs = bench_compare(compare, r, n, inject, replay, threshold,
+				      regs);
+
+	bench_print(r, n, inject, method, replay, digest, regs, nregs,
+		    compare != NULL);
+
+	return nregs ? 2 : 0;
+}
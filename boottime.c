@@ -0,0 +1,275 @@
+/*
+ * Boot-time entropy readiness measurement.
+ *
+ * Records the time from process start to the first credited injection, to
+ * getrandom(GRND_NONBLOCK) succeeding, i.e. the CRNG being ready, and to the
+ * kernel entropy level reaching the configured pool level. Along with them
+ * go the first uncredited injection, the end of the collector's self-test and
+ * the first forced CRNG reseed, along with the reseed setting (-R).
+ * The pool level is capped at the kernel's pool size. Since 5.18 the kernel
+ * level stays put once the CRNG is ready, so there a level it has not reached
+ * by then is given up on. Once the first three are known or given up on (or
+ * on shutdown) a single line is logged and appended to the report file:
+ *
+ *   urngd-boot format=1 version=1.0.1 start_ms=1840 first_inject_ms=12
+ *     crng_ready_ms=310 pool_level_ms=4210 pool_level=1024
+ *     first_uncredited_ms=3 selftest_ms=11 first_reseed_ms=14 reseed_bits=256
+ *
+ * start_ms is the process start since boot, all other times are relative to
+ * it and -1 if the event was not seen.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/random.h>
+
+#include <libubox/uloop.h>
+
+#include "log.h"
+#include "boottime.h"
+
+#define BOOTTIME_POLL_MS 10
+#define BOOTTIME_ENTROPYAVAIL "/proc/sys/kernel/random/entropy_avail"
+#define BOOTTIME_POOLSIZE "/proc/sys/kernel/random/poolsize"
+/* pool size of the kernels since 5.18, whose level is fixed once ready */
+#define BOOTTIME_FIXED_POOL 256
+
+enum boottime_event {
+	BT_FIRST_INJECT,
+	BT_FIRST_UNCREDITED,
+	BT_SELFTEST,
+	BT_FIRST_RESEED,
+	BT_CRNG_READY,
+	BT_POOL_LEVEL,
+	__BT_MAX
+};
+
+static struct {
+	struct uloop_timeout poll;
+	const char *path;
+	unsigned int level;
+	unsigned int pool_size;
+	unsigned int reseed_bits;
+	int avail_fd;
+	bool reported;
+	/* CLOCK_BOOTTIME in ms */
+	int64_t start;
+	int64_t at[__BT_MAX];
+} bt;
+
+static int64_t boottime_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* process start since boot, from /proc/self/stat, or now if unavailable */
+static int64_t boottime_start(void)
+{
+	unsigned long long ticks;
+	char buf[512];
+	char *p;
+	ssize_t len;
+	int fd, i;
+
+	fd = open("/proc/self/stat", O_RDONLY);
+	if (fd < 0)
+		return boottime_now();
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return boottime_now();
+
+	buf[len] = '\0';
+
+	/* starttime is field 22, counted after the parenthesized comm */
+	p = strrchr(buf, ')');
+	for (i = 2; p && i < 22; i++)
+		p = strchr(p + 1, ' ');
+
+	if (!p || sscanf(p, " %llu", &ticks) != 1)
+		return boottime_now();
+
+	return ticks * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+bool boottime_crng_ready(void)
+{
+#ifdef SYS_getrandom
+	char c;
+
+	return syscall(SYS_getrandom, &c, 1, GRND_NONBLOCK) == 1;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Since 5.18 the kernel reports a fixed 256 bit pool, entropy_avail never
+ * goes beyond that. Returns 0 if unknown.
+ */
+unsigned int boottime_pool_size(void)
+{
+	char buf[16];
+	ssize_t len;
+	int fd;
+
+	fd = open(BOOTTIME_POOLSIZE, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+
+	buf[len] = '\0';
+
+	return atoi(buf);
+}
+
+static unsigned int boottime_entropy_avail(void)
+{
+	char buf[16];
+	ssize_t len;
+
+	if (bt.avail_fd < 0)
+		return 0;
+
+	len = pread(bt.avail_fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return 0;
+
+	buf[len] = '\0';
+
+	return atoi(buf);
+}
+
+static void boottime_mark(enum boottime_event ev)
+{
+	if (bt.at[ev] < 0)
+		bt.at[ev] = boottime_now() - bt.start;
+}
+
+static void boottime_report(void)
+{
+	char line[320];
+	int fd, len;
+
+	if (bt.reported)
+		return;
+
+	bt.reported = true;
+	uloop_timeout_cancel(&bt.poll);
+
+	len = snprintf(line, sizeof(line), "urngd-boot format=%d version=%s "
+		 "start_ms=%lld first_inject_ms=%lld crng_ready_ms=%lld "
+		 "pool_level_ms=%lld pool_level=%u first_uncredited_ms=%lld "
+		 "selftest_ms=%lld first_reseed_ms=%lld reseed_bits=%u\n",
+		 BOOTTIME_FORMAT,
+		 URNGD_VERSION, (long long)bt.start,
+		 (long long)bt.at[BT_FIRST_INJECT],
+		 (long long)bt.at[BT_CRNG_READY],
+		 (long long)bt.at[BT_POOL_LEVEL], bt.level,
+		 (long long)bt.at[BT_FIRST_UNCREDITED],
+		 (long long)bt.at[BT_SELFTEST],
+		 (long long)bt.at[BT_FIRST_RESEED], bt.reseed_bits);
+	if (len >= (int)sizeof(line))
+		len = sizeof(line) - 1;
+
+	LOG("%s", line);
+
+	if (!bt.path)
+		return;
+
+	fd = open(bt.path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 || write(fd, line, len) != len)
+		ERROR("cannot write %s: %s\n", bt.path, strerror(errno));
+
+	if (fd >= 0)
+		close(fd);
+}
+
+static void boottime_poll_cb(struct uloop_timeout *t)
+{
+	if (boottime_crng_ready())
+		boottime_mark(BT_CRNG_READY);
+
+	if (boottime_entropy_avail() >= bt.level)
+		boottime_mark(BT_POOL_LEVEL);
+
+	/* a fixed pool does not move past the level it has once ready */
+	if (bt.at[BT_FIRST_INJECT] >= 0 && bt.at[BT_CRNG_READY] >= 0 &&
+	    (bt.at[BT_POOL_LEVEL] >= 0 ||
+	     bt.pool_size == BOOTTIME_FIXED_POOL)) {
+		boottime_report();
+		return;
+	}
+
+	uloop_timeout_set(t, BOOTTIME_POLL_MS);
+}
+
+/* path may be NULL to only log the report */
+bool boottime_init(const char *path, unsigned int level,
+		   unsigned int reseed_bits)
+{
+	unsigned int i;
+
+	bt.start = boottime_start();
+	bt.path = path;
+	bt.pool_size = boottime_pool_size();
+	bt.level = bt.pool_size && bt.pool_size < level ? bt.pool_size : level;
+	bt.reseed_bits = reseed_bits;
+	for (i = 0; i < __BT_MAX; i++)
+		bt.at[i] = -1;
+
+	bt.avail_fd = open(BOOTTIME_ENTROPYAVAIL, O_RDONLY | O_CLOEXEC);
+	bt.poll.cb = boottime_poll_cb;
+	boottime_poll_cb(&bt.poll);
+
+	return true;
+}
+
+void boottime_injected(size_t bits)
+{
+	if (bt.poll.cb)
+		boottime_mark(bits ? BT_FIRST_INJECT : BT_FIRST_UNCREDITED);
+}
+
+void boottime_reseeded(void)
+{
+	if (bt.poll.cb)
+		boottime_mark(BT_FIRST_RESEED);
+}
+
+/* the collector's power-on self-test completed */
+void boottime_selftest(void)
+{
+	if (bt.poll.cb)
+		boottime_mark(BT_SELFTEST);
+}
+
+void boottime_done(void)
+{
+	if (!bt.poll.cb)
+		return;
+
+	boottime_report();
+
+	if (bt.avail_fd >= 0)
+		close(bt.avail_fd);
+
+	bt.poll.cb = NULL;
+}
@@ -0,0 +1,25 @@
+/*
+ * Boot-time entropy readiness measurement.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __BOOTTIME_H
+#define __BOOTTIME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* bump when fields of the report line change meaning */
+#define BOOTTIME_FORMAT 1
+
+bool boottime_init(const char *path, unsigned int level,
+		   unsigned int reseed_bits);
+unsigned int boottime_pool_size(void);
+void boottime_injected(size_t bits);
+void boottime_selftest(void);
+void boottime_reseeded(void);
+bool boottime_crng_ready(void);
+void boottime_done(void);
+
+#endif
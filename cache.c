@@ -0,0 +1,159 @@
+/*
+ * CPU cache detection for sizing the memory access noise source.
+ *
+ * The memory access loop only adds jitter if its accesses miss the level 1
+ * cache, while spilling out of the last level cache makes every access a
+ * costly DRAM round trip. So the buffer is sized to twice the L1 data cache,
+ * bounded by the last level cache, and the block size follows the cache line.
+ * Without a cache beyond L1, e.g. on many MIPS SoCs, missing L1 means going
+ * to DRAM anyway, so the buffer stays at twice L1.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "cache.h"
+
+#define CACHE_SYSFS "/sys/devices/system/cpu/cpu0/cache/index%u/%s"
+#define CACHE_INDEX_MAX 8
+
+static bool cache_sysfs(unsigned int index, const char *attr, char *buf,
+			size_t len)
+{
+	char path[128];
+	FILE *fp;
+	bool ret;
+
+	snprintf(path, sizeof(path), CACHE_SYSFS, index, attr);
+	fp = fopen(path, "r");
+	if (!fp)
+		return false;
+
+	ret = fgets(buf, len, fp) != NULL;
+	fclose(fp);
+
+	if (ret)
+		buf[strcspn(buf, "\n")] = '\0';
+
+	return ret;
+}
+
+/* sizes as in sysfs, e.g. "32K" */
+static unsigned int cache_size(const char *s)
+{
+	char *end;
+	unsigned long n = strtoul(s, &end, 10);
+
+	if (*end == 'K')
+		n *= 1024;
+	else if (*end == 'M')
+		n *= 1024 * 1024;
+
+	return n;
+}
+
+static void cache_detect_sysfs(struct cache_info *ci)
+{
+	char buf[32];
+	unsigned int i, level, size;
+
+	for (i = 0; i < CACHE_INDEX_MAX; i++) {
+		if (!cache_sysfs(i, "type", buf, sizeof(buf)))
+			break;
+		if (!strcmp(buf, "Instruction"))
+			continue;
+
+		if (!cache_sysfs(i, "level", buf, sizeof(buf)))
+			continue;
+		level = atoi(buf);
+
+		if (!cache_sysfs(i, "size", buf, sizeof(buf)))
+			continue;
+		size = cache_size(buf);
+
+		if (level == 1) {
+			ci->l1d = size;
+			if (cache_sysfs(i, "coherency_line_size", buf, sizeof(buf)))
+				ci->line = atoi(buf);
+		}
+
+		if (size > ci->llc)
+			ci->llc = size;
+	}
+}
+
+static void cache_detect_sysconf(struct cache_info *ci)
+{
+	long n;
+
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+	n = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+	if (!ci->l1d && n > 0)
+		ci->l1d = n;
+#endif
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+	n = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+	if (!ci->line && n > 0)
+		ci->line = n;
+#endif
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	n = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if (n > 0 && (unsigned long)n > ci->llc)
+		ci->llc = n;
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+	n = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (n > 0 && (unsigned long)n > ci->llc)
+		ci->llc = n;
+#endif
+	(void)n;
+}
+
+bool cache_detect(struct cache_info *ci)
+{
+	memset(ci, 0, sizeof(*ci));
+
+	cache_detect_sysfs(ci);
+	if (!ci->l1d || !ci->line)
+		cache_detect_sysconf(ci);
+
+	if (!ci->l1d) {
+		LOG("cache sizes unknown, keeping the default memory access buffer\n");
+		return false;
+	}
+
+	if (ci->llc < ci->l1d)
+		ci->llc = ci->l1d;
+
+	DEBUG(1, "L1d %uK, last level %uK, line %ub\n", ci->l1d / 1024,
+	      ci->llc / 1024, ci->line);
+
+	return true;
+}
+
+bool cache_mem_geometry(const struct cache_info *ci, unsigned int *blocks,
+			unsigned int *blocksize)
+{
+	unsigned int size = 1;
+
+	if (!ci->l1d)
+		return false;
+
+	while (size < 2 * ci->l1d)
+		size <<= 1;
+
+	if (ci->llc > ci->l1d && size > ci->llc)
+		size = ci->llc;
+	if (size > CACHE_MEM_MAX)
+		size = CACHE_MEM_MAX;
+
+	*blocksize = ci->line >= 8 && ci->line <= 256 ? ci->line : 32;
+	*blocks = size / *blocksize;
+
+	return *blocks > 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * CPU cache detection for sizing the memory access noise source.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stdbool.h>
+
+/* upper bound of the memory access buffer, in bytes */
+#define CACHE_MEM_MAX (256 * 1024)
+
+struct cache_info {
+	/* level 1 data cache, in bytes */
+	unsigned int l1d;
+	/* largest data or unified cache, in bytes */
+	unsigned int llc;
+	unsigned int line;
+};
+
+bool cache_detect(struct cache_info *ci);
+bool cache_mem_geometry(const struct cache_info *ci, unsigned int *blocks,
+			unsigned int *blocksize);
+
+#endif
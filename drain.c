@@ -0,0 +1,339 @@
+/*
+ * urngd-drain - consumer load harness for a running urngd.
+ *
+ * Forks a number of consumers reading /dev/random at a steady rate, with
+ * optional bursts: a handshake storm right at the start or periodic key
+ * rotation. Meanwhile the kernel entropy level is sampled to tell how long
+ * the pool stays above the wakeup level and how long the episodes below it
+ * last. Results are printed as JSON.
+ *
+ * Meant for a disposable VM or container, it drains the real pool.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "stats.h"
+
+#define DRAIN_CONSUMERS 4
+#define DRAIN_RATE 64
+#define DRAIN_SECONDS 60
+#define DRAIN_BURST 5
+#define DRAIN_PERIOD 30
+#define DRAIN_THRESH 1024
+#define DRAIN_INTERVAL_MS 10
+#define DRAIN_CONSUMERS_MAX 256
+#define DRAIN_CHUNK 16
+#define DRAIN_HANDSHAKE 32
+#define ENTROPYAVAIL "/proc/sys/kernel/random/entropy_avail"
+
+#ifdef URNGD_DEBUG
+unsigned int debug;
+#endif
+
+enum drain_pattern {
+	DRAIN_STEADY,
+	DRAIN_STORM,
+	DRAIN_ROTATE,
+};
+
+static const char * const drain_patterns[] = {
+	[DRAIN_STEADY] = "steady",
+	[DRAIN_STORM] = "storm",
+	[DRAIN_ROTATE] = "rotate",
+};
+
+struct drain {
+	enum drain_pattern pattern;
+	unsigned int consumers;
+	unsigned int rate;
+	unsigned int seconds;
+	unsigned int burst;
+	unsigned int period;
+	unsigned int thresh;
+	unsigned int interval;
+	/* shared with the consumers, one slot each */
+	uint64_t *consumed;
+	pid_t pid[DRAIN_CONSUMERS_MAX];
+};
+
+static bool drain_bursting(struct drain *d, uint64_t elapsed)
+{
+	uint64_t s = elapsed / 1000000000ULL;
+
+	switch (d->pattern) {
+	case DRAIN_STORM:
+		return s < d->burst;
+	case DRAIN_ROTATE:
+		return d->period && s % d->period < d->burst;
+	default:
+		return false;
+	}
+}
+
+static void drain_sleep(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ULL,
+		.tv_nsec = ns % 1000000000ULL,
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+static void drain_consumer(struct drain *d, unsigned int n, uint64_t start)
+{
+	char buf[DRAIN_HANDSHAKE];
+	uint64_t end = start + d->seconds * 1000000000ULL, now;
+	ssize_t ret;
+	int fd;
+
+	fd = open("/dev/random", O_RDONLY);
+	if (fd < 0) {
+		ERROR("/dev/random open failed: %s\n", strerror(errno));
+		_exit(1);
+	}
+
+	while ((now = stats_now_ns()) < end) {
+		if (drain_bursting(d, now - start)) {
+			ret = read(fd, buf, DRAIN_HANDSHAKE);
+		} else {
+			ret = read(fd, buf, DRAIN_CHUNK);
+			if (d->rate)
+				drain_sleep(DRAIN_CHUNK * 1000000000ULL / d->rate);
+		}
+
+		if (ret > 0)
+			d->consumed[n] += ret;
+		else if (ret < 0 && errno != EINTR)
+			break;
+	}
+
+	close(fd);
+	_exit(0);
+}
+
+static bool drain_start(struct drain *d, uint64_t start)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->consumers; i++) {
+		d->pid[i] = fork();
+		if (d->pid[i] < 0) {
+			ERROR("fork failed: %s\n", strerror(errno));
+			return false;
+		}
+		if (!d->pid[i])
+			drain_consumer(d, i, start);
+	}
+
+	return true;
+}
+
+static void drain_stop(struct drain *d)
+{
+	unsigned int i;
+
+	/* consumers may still be blocked in read() on an empty pool */
+	for (i = 0; i < d->consumers; i++)
+		if (d->pid[i] > 0)
+			kill(d->pid[i], SIGTERM);
+
+	for (i = 0; i < d->consumers; i++)
+		if (d->pid[i] > 0)
+			waitpid(d->pid[i], NULL, 0);
+}
+
+static int drain_level(int fd)
+{
+	char buf[16];
+	ssize_t len;
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return -1;
+
+	buf[len] = '\0';
+	return atoi(buf);
+}
+
+static void drain_print(struct drain *d, struct stats_hist *level,
+			struct stats_hist *below, uint64_t below_ns,
+			uint64_t elapsed)
+{
+	uint64_t consumed = 0;
+	unsigned int i;
+	bool first = true;
+
+	for (i = 0; i < d->consumers; i++)
+		consumed += d->consumed[i];
+
+	printf("{\n");
+	printf("  \"version\": \"%s\",\n", URNGD_VERSION);
+	printf("  \"pattern\": \"%s\",\n", drain_patterns[d->pattern]);
+	printf("  \"consumers\": %u,\n", d->consumers);
+	printf("  \"rate_bytes_per_sec\": %u,\n", d->rate);
+	printf("  \"seconds\": %.1f,\n", elapsed / 1e9);
+	printf("  \"threshold_bits\": %u,\n", d->thresh);
+	printf("  \"consumed_bytes\": %llu,\n", (unsigned long long)consumed);
+	printf("  \"level_mean_bits\": %.1f,\n",
+	       level->count ? (double)level->sum / level->count : 0);
+	printf("  \"above_threshold_pct\": %.2f,\n",
+	       elapsed ? 100.0 - below_ns * 100.0 / elapsed : 0);
+	printf("  \"below_episodes\": %llu,\n", (unsigned long long)below->count);
+	printf("  \"below_ms_mean\": %.3f,\n",
+	       below->count ? below->sum / 1e6 / below->count : 0);
+	printf("  \"below_ms_max\": %.3f,\n", below->max / 1e6);
+	printf("  \"below_ms_hist\": [");
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		if (!below->bucket[i])
+			continue;
+		printf("%s\n    { \"lt_ms\": %.3f, \"count\": %u }",
+		       first ? "" : ",", (double)(1ULL << i) / 1e6,
+		       below->bucket[i]);
+		first = false;
+	}
+	printf("%s]\n", first ? "" : "\n  ");
+	printf("}\n");
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"Options:\n"
+		"	-b <seconds>	Length of a burst (default %d)\n"
+		"	-c <n>		Number of consumers (default %d)\n"
+		"	-i <ms>		Entropy level sampling interval (default %d)\n"
+		"	-l <bits>	Threshold the pool should stay above (default %d)\n"
+		"	-p <pattern>	steady, storm (burst at start) or rotate (periodic bursts)\n"
+		"	-P <seconds>	Period of the rotate bursts (default %d)\n"
+		"	-r <bytes/s>	Steady drain rate per consumer, 0 for back to back (default %d)\n"
+		"	-t <seconds>	Duration of the run (default %d)\n"
+		"\n", prog, DRAIN_BURST, DRAIN_CONSUMERS, DRAIN_INTERVAL_MS,
+		DRAIN_THRESH, DRAIN_PERIOD, DRAIN_RATE, DRAIN_SECONDS);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct drain d = {
+		.pattern = DRAIN_STEADY,
+		.consumers = DRAIN_CONSUMERS,
+		.rate = DRAIN_RATE,
+		.seconds = DRAIN_SECONDS,
+		.burst = DRAIN_BURST,
+		.period = DRAIN_PERIOD,
+		.thresh = DRAIN_THRESH,
+		.interval = DRAIN_INTERVAL_MS,
+	};
+	struct stats_hist level = { 0 }, below = { 0 };
+	uint64_t start, now, end, below_start = 0, below_ns = 0;
+	int ch, fd, bits;
+	size_t i;
+
+	while ((ch = getopt(argc, argv, "b:c:i:l:p:P:r:t:")) != -1) {
+		switch (ch) {
+		case 'b':
+			d.burst = atoi(optarg);
+			break;
+		case 'c':
+			d.consumers = atoi(optarg);
+			break;
+		case 'i':
+			d.interval = atoi(optarg);
+			break;
+		case 'l':
+			d.thresh = atoi(optarg);
+			break;
+		case 'p':
+			for (i = 0; i < sizeof(drain_patterns) / sizeof(drain_patterns[0]); i++)
+				if (!strcmp(optarg, drain_patterns[i]))
+					break;
+			if (i == sizeof(drain_patterns) / sizeof(drain_patterns[0]))
+				return usage(argv[0]);
+			d.pattern = i;
+			break;
+		case 'P':
+			d.period = atoi(optarg);
+			break;
+		case 'r':
+			d.rate = atoi(optarg);
+			break;
+		case 't':
+			d.seconds = atoi(optarg);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (d.consumers > DRAIN_CONSUMERS_MAX || !d.interval)
+		return usage(argv[0]);
+
+	ulog_open(ULOG_STDIO, LOG_USER, "urngd-drain");
+
+	fd = open(ENTROPYAVAIL, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ERROR(ENTROPYAVAIL " open failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	d.consumed = mmap(NULL, DRAIN_CONSUMERS_MAX * sizeof(*d.consumed),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+			  -1, 0);
+	if (d.consumed == MAP_FAILED) {
+		ERROR("mmap failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	start = stats_now_ns();
+	end = start + d.seconds * 1000000000ULL;
+
+	if (!drain_start(&d, start)) {
+		drain_stop(&d);
+		return 1;
+	}
+
+	while ((now = stats_now_ns()) < end) {
+		bits = drain_level(fd);
+		if (bits >= 0) {
+			stats_hist_add(&level, bits);
+
+			if (bits < (int)d.thresh && !below_start) {
+				below_start = now;
+			} else if (bits >= (int)d.thresh && below_start) {
+				stats_hist_add(&below, now - below_start);
+				below_ns += now - below_start;
+				below_start = 0;
+			}
+		}
+
+		drain_sleep(d.interval * 1000000ULL);
+	}
+
+	if (below_start) {
+		stats_hist_add(&below, now - below_start);
+		below_ns += now - below_start;
+	}
+
+	drain_stop(&d);
+	drain_print(&d, &level, &below, below_ns, now - start);
+
+	munmap(d.consumed, DRAIN_CONSUMERS_MAX * sizeof(*d.consumed));
+	close(fd);
+
+	return 0;
+}
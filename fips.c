@@ -0,0 +1,158 @@
+/*
+ * FIPS 140-2 statistical self-tests over the injected jitter output.
+ *
+ * Blocks are streamed into a 20000 bit window a 64-bit word at a time:
+ * monobit uses popcount, runs jump from one bit flip to the next with
+ * count-trailing-zeros, so the cost is a handful of instructions per word
+ * rather than per bit. Bits are taken LSB first from host order words.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <string.h>
+
+#include "fips.h"
+
+static const unsigned int fips_runs_min[6] = { 2315, 1114, 527, 240, 103, 103 };
+static const unsigned int fips_runs_max[6] = { 2685, 1386, 723, 384, 209, 209 };
+
+void fips_reset(struct fips *f)
+{
+	unsigned int failed = f->failed;
+
+	memset(f, 0, sizeof(*f));
+	f->cur = -1;
+	f->failed = failed;
+}
+
+static void fips_run_end(struct fips *f)
+{
+	unsigned int len = f->run;
+
+	if (len > f->longest)
+		f->longest = len;
+	if (len > 6)
+		len = 6;
+
+	f->runs[f->cur][len - 1]++;
+	f->run = 0;
+}
+
+static void fips_word(struct fips *f, uint64_t x, unsigned int bits)
+{
+	unsigned int i, n;
+	uint64_t y;
+
+	f->ones += __builtin_popcountll(x);
+	for (i = 0; i < bits; i += 4)
+		f->poker[(x >> i) & 0xf]++;
+
+	if (f->cur < 0)
+		f->cur = x & 1;
+
+	while (bits) {
+		/* bits differing from the current run are set in y */
+		y = f->cur ? ~x : x;
+		if (bits < 64)
+			y |= ~0ULL << bits;
+
+		n = y ? (unsigned int)__builtin_ctzll(y) : bits;
+		f->run += n;
+		if (n == bits)
+			break;
+
+		fips_run_end(f);
+		f->cur ^= 1;
+		x >>= n;
+		bits -= n;
+	}
+}
+
+static void fips_feed(struct fips *f, const unsigned char *p, size_t len)
+{
+	uint64_t x;
+
+	f->bytes += len;
+
+	for (; len >= sizeof(x); len -= sizeof(x), p += sizeof(x)) {
+		memcpy(&x, p, sizeof(x));
+		fips_word(f, x, 64);
+	}
+
+	if (len) {
+		x = 0;
+		memcpy(&x, p, len);
+		fips_word(f, x, len * 8);
+	}
+}
+
+static unsigned int fips_finish(struct fips *f)
+{
+	unsigned int i, failed = 0;
+	uint64_t sum = 0;
+	int64_t poker;
+
+	if (f->run)
+		fips_run_end(f);
+
+	if (f->ones <= 9725 || f->ones >= 10275)
+		failed |= FIPS_MONOBIT;
+
+	/* 5000 * X = 16 * sum(f(i)^2) - 5000^2, with 2.16 < X < 46.17 */
+	for (i = 0; i < 16; i++)
+		sum += (uint64_t)f->poker[i] * f->poker[i];
+	poker = (int64_t)(16 * sum) - 25000000;
+	if (poker <= 10800 || poker >= 230850)
+		failed |= FIPS_POKER;
+
+	for (i = 0; i < 6; i++) {
+		if (f->runs[0][i] < fips_runs_min[i] ||
+		    f->runs[0][i] > fips_runs_max[i] ||
+		    f->runs[1][i] < fips_runs_min[i] ||
+		    f->runs[1][i] > fips_runs_max[i])
+			failed |= FIPS_RUNS;
+	}
+
+	if (f->longest >= 26)
+		failed |= FIPS_LONGRUN;
+
+	f->failed = failed;
+	fips_reset(f);
+
+	return failed;
+}
+
+/*
+ * Stream len bytes into the test window. Returns FIPS_PENDING until a window
+ * completes, then the verdict over it; a failure anywhere in data wins.
+ */
+enum fips_result fips_update(struct fips *f, const void *data, size_t len)
+{
+	enum fips_result ret = FIPS_PENDING;
+	const unsigned char *p = data;
+	unsigned int failed = 0;
+	size_t n;
+
+	while (len) {
+		n = FIPS_WINDOW_BYTES - f->bytes;
+		if (n > len)
+			n = len;
+
+		fips_feed(f, p, n);
+		p += n;
+		len -= n;
+
+		if (f->bytes < FIPS_WINDOW_BYTES)
+			break;
+
+		failed |= fips_finish(f);
+		ret = FIPS_PASS;
+	}
+
+	if (failed) {
+		f->failed = failed;
+		ret = FIPS_FAIL;
+	}
+
+	return ret;
+}
@@ -0,0 +1,42 @@
+/*
+ * FIPS 140-2 statistical self-tests over the injected jitter output.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __FIPS_H
+#define __FIPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the tests are defined over 20000 consecutive bits */
+#define FIPS_WINDOW_BYTES 2500
+
+#define FIPS_MONOBIT	(1 << 0)
+#define FIPS_POKER	(1 << 1)
+#define FIPS_RUNS	(1 << 2)
+#define FIPS_LONGRUN	(1 << 3)
+
+enum fips_result {
+	FIPS_PENDING,
+	FIPS_PASS,
+	FIPS_FAIL,
+};
+
+struct fips {
+	unsigned int bytes;
+	unsigned int ones;
+	unsigned int poker[16];
+	unsigned int runs[2][6];
+	unsigned int longest;
+	unsigned int run;
+	int cur;
+	/* tests failed by the last completed window */
+	unsigned int failed;
+};
+
+void fips_reset(struct fips *f);
+enum fips_result fips_update(struct fips *f, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Print the flash and memory footprint of urngd as JSON.
+#
+# usage: footprint.sh <urngd binary> [strip]
+#
+# The steady-state RSS is taken from a short run against the simulated pool,
+# which is only possible when the binary runs on this host.
+
+bin=$1
+strip=${2:-strip}
+size=${strip%strip}size
+seconds=5
+
+[ -x "$bin" ] || { echo "usage: $0 <urngd binary> [strip]" >&2; exit 1; }
+
+set -- $("$size" "$bin" 2>/dev/null | tail -n 1)
+text=${1:-0} data=${2:-0} bss=${3:-0}
+
+file=$(wc -c < "$bin")
+tmp=$(mktemp)
+"$strip" -o "$tmp" "$bin" 2>/dev/null && stripped=$(wc -c < "$tmp") || stripped=0
+rm -f "$tmp"
+
+rss=0
+"$bin" -S -M "" -z 100000 -T $seconds >/dev/null 2>&1 &
+pid=$!
+sleep $((seconds - 1))
+[ -r /proc/$pid/status ] &&
+	rss=$(sed -n 's/^VmRSS:[[:space:]]*\([0-9]*\) kB/\1/p' /proc/$pid/status)
+wait $pid 2>/dev/null
+
+cat <<EOT
+{
+  "binary": "$bin",
+  "file_bytes": $file,
+  "stripped_bytes": $stripped,
+  "text_bytes": $text,
+  "data_bytes": $data,
+  "bss_bytes": $bss,
+  "rss_kb": ${rss:-0}
+}
+EOT
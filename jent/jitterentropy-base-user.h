@@ -0,0 +1,21 @@
+/*
+ * Takes the place of the Jitter RNG core's jitterentropy-base-user.h when
+ * building urngd's copy of jitterentropy-base.c. All of the original is
+ * used, only the collector's timer reads go through noise_nstime(), which
+ * lets urngd see the time deltas the collector measures, see noise.c.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include_next <jitterentropy-base-user.h>
+
+#ifndef __URNGD_JENT_USER_H
+#define __URNGD_JENT_USER_H
+
+#include <stdint.h>
+
+uint64_t noise_nstime(void);
+
+#define jent_get_nstime(out) (*(out) = noise_nstime())
+
+#endif
@@ -18,9 +18,14 @@
 #include <libubox/ulog.h>
 
 #ifdef URNGD_DEBUG
+#include "trace.h"
+
 #define DEBUG(level, fmt, ...) do { \
 	if (debug >= level) { \
-		ulog(LOG_DEBUG, fmt, ## __VA_ARGS__); \
+		if (trace_enabled) \
+			trace_printf(level, fmt, ## __VA_ARGS__); \
+		else \
+			ulog(LOG_DEBUG, fmt, ## __VA_ARGS__); \
 	} } while (0)
 #else
 #define DEBUG(level, fmt, ...)
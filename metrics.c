@@ -0,0 +1,344 @@
+/*
+ * Prometheus text exposition of the runtime statistics.
+ *
+ * Scrapes are answered over HTTP/1.0 on a unix socket (addr starting with
+ * '/') or on a loopback TCP port ([host:]port) from within the uloop. The
+ * exposition is rendered into a static buffer only after the statistics
+ * changed, so scrapes neither allocate nor re-render. Client sockets stay
+ * non-blocking, a slow client is fed from ULOOP_WRITE callbacks and the
+ * buffer is not re-rendered while any response is still in flight.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <libubox/uloop.h>
+#include <libubox/usock.h>
+
+#include "log.h"
+#include "stats.h"
+#include "metrics.h"
+
+#define METRICS_CLIENTS 4
+#define METRICS_BUF 16384
+
+struct metrics_client {
+	struct uloop_fd fd;
+	struct uloop_timeout timeout;
+	bool sending;
+	/* bytes of header and exposition already sent */
+	size_t pos;
+};
+
+static struct {
+	struct uloop_fd server;
+	struct metrics_client client[METRICS_CLIENTS];
+	const struct stats *stats;
+	const char *path;
+	bool dirty;
+	size_t len;
+	char header[128];
+	char buf[METRICS_BUF];
+} m;
+
+static void metrics_printf(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static void metrics_printf(const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	if (m.len >= sizeof(m.buf))
+		return;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(m.buf + m.len, sizeof(m.buf) - m.len, fmt, ap);
+	va_end(ap);
+
+	if (ret > 0)
+		m.len += ret;
+	if (m.len > sizeof(m.buf))
+		m.len = sizeof(m.buf);
+}
+
+static void metrics_counter(const char *name, const char *help, uint64_t val)
+{
+	metrics_printf("# HELP urngd_%s %s\n# TYPE urngd_%s counter\n"
+		       "urngd_%s %llu\n", name, help, name, name,
+		       (unsigned long long)val);
+}
+
+/*
+ * scale converts the histogram unit to the exposed one, e.g. ns to s, and
+ * only the first buckets are exposed individually. Values are integers, so
+ * bucket i, which counts those below 2^i, holds up to 2^i - 1 inclusive.
+ */
+static void metrics_hist(const char *name, const char *help,
+			 const struct stats_hist *h, double scale,
+			 unsigned int buckets)
+{
+	uint64_t cum = 0;
+	unsigned int i;
+
+	metrics_printf("# HELP urngd_%s %s\n# TYPE urngd_%s histogram\n",
+		       name, help, name);
+
+	for (i = 0; i < buckets && i < STATS_BUCKETS - 1; i++) {
+		cum += h->bucket[i];
+		metrics_printf("urngd_%s_bucket{le=\"%.9g\"} %llu\n", name,
+			       (double)((1ULL << i) - 1) / scale,
+			       (unsigned long long)cum);
+	}
+
+	metrics_printf("urngd_%s_bucket{le=\"+Inf\"} %llu\n"
+		       "urngd_%s_sum %.9g\nurngd_%s_count %llu\n",
+		       name, (unsigned long long)h->count,
+		       name, h->sum / scale,
+		       name, (unsigned long long)h->count);
+}
+
+static void metrics_render(void)
+{
+	const struct stats *s = m.stats;
+
+	m.len = 0;
+
+	metrics_counter("wakeups_total", "Low entropy wakeups.", s->wakeups);
+	metrics_counter("injected_bytes_total", "Bytes injected into the kernel.",
+			s->injected_bytes);
+	metrics_counter("credited_bits_total", "Entropy bits credited.",
+			s->credited_bits);
+	metrics_counter("recoveries_total", "Collector re-initializations.",
+			s->recoveries);
+	metrics_counter("flash_writes_total", "Seed journal writes.",
+			s->flash_writes);
+	metrics_counter("reseeds_total", "CRNG reseeds forced.", s->reseeds);
+
+	metrics_printf("# HELP urngd_errors_total Failures on the injection path.\n"
+		       "# TYPE urngd_errors_total counter\n"
+		       "urngd_errors_total{type=\"ioctl\"} %llu\n"
+		       "urngd_errors_total{type=\"read\"} %llu\n"
+		       "urngd_errors_total{type=\"fips\"} %llu\n",
+		       (unsigned long long)s->ioctl_failures,
+		       (unsigned long long)s->read_failures,
+		       (unsigned long long)s->fips_failures);
+
+	metrics_printf("# HELP urngd_kernel_entropy_avail_bits Kernel entropy "
+		       "level at the last wakeup.\n"
+		       "# TYPE urngd_kernel_entropy_avail_bits gauge\n"
+		       "urngd_kernel_entropy_avail_bits %llu\n",
+		       (unsigned long long)s->entropy_avail);
+
+	metrics_hist("kernel_entropy_bits", "Kernel entropy level at wakeups.",
+		     &s->entropy_level, 1, 14);
+	metrics_hist("jent_read_seconds", "jent_read_entropy() latency.",
+		     &s->collect, 1e9, STATS_BUCKETS);
+	metrics_hist("rndaddentropy_seconds", "RNDADDENTROPY ioctl latency.",
+		     &s->ioctl, 1e9, STATS_BUCKETS);
+	metrics_hist("wakeup_to_credit_seconds", "Low entropy signal to credit.",
+		     &s->wakeup_credit, 1e9, STATS_BUCKETS);
+
+	snprintf(m.header, sizeof(m.header),
+		 "HTTP/1.0 200 OK\r\n"
+		 "Content-Type: text/plain; version=0.0.4\r\n"
+		 "Content-Length: %zu\r\n\r\n", m.len);
+
+	m.dirty = false;
+}
+
+static void metrics_client_close(struct metrics_client *c)
+{
+	uloop_timeout_cancel(&c->timeout);
+	uloop_fd_delete(&c->fd);
+	close(c->fd.fd);
+	c->fd.fd = -1;
+	c->sending = false;
+}
+
+static void metrics_client_timeout(struct uloop_timeout *t)
+{
+	metrics_client_close(container_of(t, struct metrics_client, timeout));
+}
+
+static bool metrics_sending(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < METRICS_CLIENTS; i++)
+		if (m.client[i].fd.fd >= 0 && m.client[i].sending)
+			return true;
+
+	return false;
+}
+
+/* returns false once the client is done with, one way or the other */
+static bool metrics_client_send(struct metrics_client *c)
+{
+	size_t hlen = strlen(m.header);
+	struct iovec iov[2];
+	int n = 0;
+	ssize_t ret;
+
+	if (c->pos < hlen) {
+		iov[n].iov_base = m.header + c->pos;
+		iov[n++].iov_len = hlen - c->pos;
+		iov[n].iov_base = m.buf;
+		iov[n++].iov_len = m.len;
+	} else {
+		iov[n].iov_base = m.buf + c->pos - hlen;
+		iov[n++].iov_len = m.len - (c->pos - hlen);
+	}
+
+	ret = writev(c->fd.fd, iov, n);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return true;
+
+		DEBUG(1, "metrics scrape failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	c->pos += ret;
+	if (c->pos < hlen + m.len)
+		return true;
+
+	shutdown(c->fd.fd, SHUT_WR);
+	return false;
+}
+
+/* the request itself does not matter, any of them gets the exposition */
+static void metrics_client_cb(struct uloop_fd *ufd, unsigned int events)
+{
+	struct metrics_client *c = container_of(ufd, struct metrics_client, fd);
+	char req[256];
+	ssize_t ret;
+
+	if (!c->sending) {
+		ret = read(ufd->fd, req, sizeof(req));
+		if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+
+		if (ret <= 0) {
+			metrics_client_close(c);
+			return;
+		}
+
+		/* a response still in flight keeps its exposition consistent */
+		if (m.dirty && !metrics_sending())
+			metrics_render();
+
+		c->sending = true;
+		c->pos = 0;
+		uloop_fd_add(ufd, ULOOP_WRITE);
+	}
+
+	if (!metrics_client_send(c))
+		metrics_client_close(c);
+}
+
+static void metrics_accept_cb(struct uloop_fd *ufd, unsigned int events)
+{
+	struct metrics_client *c = NULL;
+	unsigned int i;
+	int fd;
+
+	for (;;) {
+		fd = accept(ufd->fd, NULL, NULL);
+		if (fd < 0)
+			return;
+
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+		for (i = 0; i < METRICS_CLIENTS; i++) {
+			if (m.client[i].fd.fd < 0) {
+				c = &m.client[i];
+				break;
+			}
+		}
+
+		if (!c) {
+			close(fd);
+			continue;
+		}
+
+		c->fd.fd = fd;
+		c->fd.cb = metrics_client_cb;
+		c->timeout.cb = metrics_client_timeout;
+		uloop_fd_add(&c->fd, ULOOP_READ);
+		uloop_timeout_set(&c->timeout, 5000);
+		c = NULL;
+	}
+}
+
+bool metrics_init(const char *addr, const struct stats *s)
+{
+	char host[64] = "127.0.0.1";
+	const char *port = addr;
+	const char *sep;
+	unsigned int i;
+
+	for (i = 0; i < METRICS_CLIENTS; i++)
+		m.client[i].fd.fd = -1;
+
+	if (addr[0] == '/') {
+		unlink(addr);
+		m.server.fd = usock(USOCK_UNIX | USOCK_SERVER | USOCK_NONBLOCK,
+				    addr, NULL);
+		m.path = addr;
+	} else {
+		sep = strrchr(addr, ':');
+		if (sep) {
+			snprintf(host, sizeof(host), "%.*s", (int)(sep - addr), addr);
+			port = sep + 1;
+		}
+
+		m.server.fd = usock(USOCK_TCP | USOCK_SERVER | USOCK_NONBLOCK |
+				    USOCK_NUMERIC, host, port);
+	}
+
+	if (m.server.fd < 0) {
+		ERROR("cannot listen on %s: %s\n", addr, strerror(errno));
+		return false;
+	}
+
+	m.stats = s;
+	m.dirty = true;
+	m.server.cb = metrics_accept_cb;
+	uloop_fd_add(&m.server, ULOOP_READ);
+
+	return true;
+}
+
+void metrics_update(void)
+{
+	m.dirty = true;
+}
+
+void metrics_done(void)
+{
+	unsigned int i;
+
+	if (!m.stats)
+		return;
+
+	for (i = 0; i < METRICS_CLIENTS; i++)
+		if (m.client[i].fd.fd >= 0)
+			metrics_client_close(&m.client[i]);
+
+	uloop_fd_delete(&m.server);
+	close(m.server.fd);
+	if (m.path)
+		unlink(m.path);
+
+	m.stats = NULL;
+}
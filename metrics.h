@@ -0,0 +1,18 @@
+/*
+ * Prometheus text exposition of the runtime statistics.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include <stdbool.h>
+
+struct stats;
+
+bool metrics_init(const char *addr, const struct stats *s);
+void metrics_update(void);
+void metrics_done(void);
+
+#endif
@@ -0,0 +1,555 @@
+/*
+ * Raw timing noise sampling and entropy estimation for urngd.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "noise.h"
+#include "jitterentropy.h"
+
+#define NOISE_CPU_LEN 64
+#define NOISE_STORE_LINE (NOISE_CPU_LEN + 32)
+#define NOISE_STORE_MAX 32
+/* consecutive stuck measurements before noise_read() gives up */
+#define NOISE_STUCK_MAX 1024
+
+struct noise_samples {
+	uint64_t *s;
+	size_t len;
+	size_t n;
+};
+
+struct noise_entry {
+	char cpu[NOISE_CPU_LEN];
+	double h;
+};
+
+static unsigned char noise_mem[JENT_MEMORY_SIZE];
+static unsigned int noise_memlocation;
+
+/*
+ * The collector whose measurements are watched by noise_nstime(), per
+ * thread as the boot workers run collectors of their own.
+ */
+static __thread struct rand_data *noise_ec;
+static __thread uint64_t noise_prev;
+static __thread bool noise_skip;
+static __thread noise_fn noise_cb;
+static __thread void *noise_cb_arg;
+#ifdef URNGD_DEBUG
+static __thread struct noise_profile noise_prof;
+#endif
+
+/*
+ * Recorded time deltas the collector's timer reads take instead of the
+ * live timer, see noise_replay_open(). Only used by the single threaded
+ * urngd-bench.
+ */
+static uint64_t *noise_replay;
+static size_t noise_replay_len;
+static size_t noise_replay_pos;
+static uint64_t noise_replay_now;
+
+static inline uint64_t noise_time(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * A measurement of the collector stores its time stamp in ->prev_time, so
+ * a change seen on the next timer read gives its time delta. The first one
+ * after watching starts spans whatever ran since the previous read call
+ * and is skipped.
+ */
+static void noise_measured(void)
+{
+	uint64_t delta = noise_ec->prev_time - noise_prev;
+
+	noise_prev = noise_ec->prev_time;
+	if (noise_skip) {
+		noise_skip = false;
+		return;
+	}
+
+#ifdef URNGD_DEBUG
+	noise_prof.measurements++;
+	noise_prof.ticks += delta;
+#endif
+
+	if (noise_cb && !noise_cb(delta, noise_cb_arg))
+		noise_cb = NULL;
+}
+
+/* every timer read of the collector, see jent/jitterentropy-base-user.h */
+uint64_t noise_nstime(void)
+{
+	__u64 now;
+
+	if (noise_replay) {
+		now = noise_replay_now += noise_replay[noise_replay_pos++];
+		if (noise_replay_pos == noise_replay_len)
+			noise_replay_pos = 0;
+	} else {
+		jent_get_nstime(&now);
+	}
+
+	if (!noise_ec)
+		return now;
+
+#ifdef URNGD_DEBUG
+	noise_prof.reads++;
+#endif
+	if (noise_ec->prev_time != noise_prev)
+		noise_measured();
+
+	return now;
+}
+
+/* watch the measurements of ec in this thread, NULL stops */
+void noise_watch(struct rand_data *ec)
+{
+	noise_ec = ec;
+	if (!ec)
+		return;
+
+	noise_prev = ec->prev_time;
+	noise_skip = true;
+}
+
+#ifdef URNGD_DEBUG
+/* what the collectors watched by this thread measured so far */
+void noise_profile(struct noise_profile *p)
+{
+	*p = noise_prof;
+}
+#endif
+
+/*
+ * Hand the time delta of every measurement ec takes to fn, in order and
+ * without gaps, until fn returns false. These are the very deltas the
+ * collector health tests and folds into its output, which is discarded.
+ */
+bool noise_record(struct rand_data *ec, noise_fn fn, void *arg)
+{
+	struct rand_data *watched = noise_ec;
+	bool ok = true;
+	char c = 0;
+
+	noise_watch(ec);
+	noise_cb = fn;
+	noise_cb_arg = arg;
+
+	while (noise_cb) {
+		if (jent_read_entropy(ec, &c, 1) < 0) {
+			ok = false;
+			break;
+		}
+	}
+
+	c = 0;
+	__asm__ __volatile__("" : : "r" (&c) : "memory");
+	noise_cb = NULL;
+	noise_watch(watched);
+
+	return ok;
+}
+
+static bool noise_store(uint64_t delta, void *arg)
+{
+	struct noise_samples *ns = arg;
+
+	ns->s[ns->len++] = delta;
+
+	return ns->len < ns->n;
+}
+
+/* n consecutive time deltas measured by ec, 0 if the collector failed */
+size_t noise_sample(struct rand_data *ec, uint64_t *deltas, size_t n)
+{
+	struct noise_samples ns = { .s = deltas, .n = n };
+
+	if (!n || !noise_record(ec, noise_store, &ns))
+		return 0;
+
+	return n;
+}
+
+/* same access pattern as the collector's memory access noise source */
+static void noise_memaccess(void)
+{
+	unsigned int i;
+	volatile unsigned char *mem = noise_mem;
+
+	for (i = 0; i < JENT_MEMORY_ACCESSLOOPS; i++) {
+		mem[noise_memlocation] = (mem[noise_memlocation] + 1) & 0xff;
+		noise_memlocation += JENT_MEMORY_BLOCKSIZE - 1;
+		noise_memlocation %= JENT_MEMORY_SIZE;
+	}
+}
+
+/*
+ * Replace the collector's timer by a trace of time deltas as written by
+ * rawdump_run(), wrapping around at its end. Every timer read takes the
+ * next delta, so a collector allocated afterwards computes an output that
+ * only depends on the trace and on jitterentropy-base.c. Traces recorded
+ * on a device of the other endianness are recognized by their implausibly
+ * large deltas and swapped.
+ */
+bool noise_replay_open(const char *path)
+{
+	struct stat st;
+	size_t i, n;
+	uint64_t *s;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		ERROR("cannot open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	if (fstat(fileno(fp), &st) || st.st_size < (off_t)sizeof(*s)) {
+		ERROR("%s: not a trace\n", path);
+		fclose(fp);
+		return false;
+	}
+
+	n = st.st_size / sizeof(*s);
+	s = malloc(n * sizeof(*s));
+	if (!s || fread(s, sizeof(*s), n, fp) != n) {
+		ERROR("cannot read %s\n", path);
+		free(s);
+		fclose(fp);
+		return false;
+	}
+
+	fclose(fp);
+
+	if (s[0] >> 32 && !(__builtin_bswap64(s[0]) >> 32))
+		for (i = 0; i < n; i++)
+			s[i] = __builtin_bswap64(s[i]);
+
+	noise_replay_close();
+	noise_replay = s;
+	noise_replay_len = n;
+	noise_replay_pos = 0;
+	noise_replay_now = 0;
+
+	LOG("replaying %zu time deltas from %s\n", n, path);
+
+	return true;
+}
+
+void noise_replay_close(void)
+{
+	free(noise_replay);
+	noise_replay = NULL;
+	noise_replay_len = 0;
+}
+
+/* LFSR with x^64 + x^61 + x^56 + x^31 + x^28 + x^23 + 1, as the collector */
+static uint64_t noise_lfsr(uint64_t data, uint64_t time)
+{
+	unsigned int i;
+	uint64_t fb;
+
+	for (i = 0; i < 64; i++) {
+		fb = (data >> 63) ^ (data >> 60) ^ (data >> 55) ^
+		     (data >> 30) ^ (data >> 27) ^ (data >> 22);
+		data = (data << 1) | ((fb ^ (time >> i)) & 1);
+	}
+
+	return data;
+}
+
+/*
+ * Uncredited stand-in for the collector while its self-test still runs:
+ * each 64 bit word is the LFSR over 64 * osr time deltas of the memory
+ * access loop, skipping stuck ones. Nothing credited or measured comes
+ * from here. Returns -1 if the noise source got stuck for good.
+ */
+ssize_t noise_read(void *buf, size_t len, unsigned int osr)
+{
+	uint64_t now, delta, delta2, delta3;
+	uint64_t prev = noise_time(), last = 0, last2 = 0, data = 0;
+	unsigned int i, stuck = 0;
+	unsigned char *p = buf;
+	size_t n, done = 0;
+
+	while (done < len) {
+		for (i = 0; i < 64 * osr; ) {
+			noise_memaccess();
+			now = noise_time();
+			delta = now - prev;
+			delta2 = delta - last;
+			delta3 = delta2 - last2;
+			prev = now;
+			last = delta;
+			last2 = delta2;
+
+			if (!delta || !delta2 || !delta3) {
+				if (++stuck > NOISE_STUCK_MAX)
+					return -1;
+				continue;
+			}
+
+			stuck = 0;
+			data = noise_lfsr(data, delta);
+			i++;
+		}
+
+		n = len - done < sizeof(data) ? len - done : sizeof(data);
+		memcpy(p + done, &data, n);
+		done += n;
+	}
+
+	return done;
+}
+
+static int noise_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * SP 800-90B most common value estimate, in bits of min-entropy per sample.
+ * Sorts the samples in place.
+ */
+double noise_min_entropy(uint64_t *samples, size_t n)
+{
+	size_t i, run = 1, max = 1;
+	double p, pu;
+
+	if (n < 2)
+		return 0;
+
+	qsort(samples, n, sizeof(*samples), noise_cmp);
+	for (i = 1; i < n; i++) {
+		run = (samples[i] == samples[i - 1]) ? run + 1 : 1;
+		if (run > max)
+			max = run;
+	}
+
+	p = (double)max / n;
+	pu = p + 2.576 * sqrt(p * (1.0 - p) / (n - 1));
+	if (pu > 1.0)
+		pu = 1.0;
+
+	return -log2(pu);
+}
+
+/*
+ * Min-entropy per sample and mean cost of a sample in timer ticks, measured
+ * on the collector ec.
+ */
+bool noise_quality(struct rand_data *ec, double *h, double *cost)
+{
+	uint64_t *samples;
+	uint64_t sum = 0;
+	size_t i;
+
+	samples = calloc(NOISE_CALIB_SAMPLES, sizeof(*samples));
+	if (!samples)
+		return false;
+
+	if (!noise_sample(ec, samples, NOISE_CALIB_SAMPLES)) {
+		free(samples);
+		return false;
+	}
+
+	for (i = 0; i < NOISE_CALIB_SAMPLES; i++)
+		sum += samples[i];
+
+	*cost = (double)sum / NOISE_CALIB_SAMPLES;
+	*h = noise_min_entropy(samples, NOISE_CALIB_SAMPLES);
+	free(samples);
+
+	return true;
+}
+
+static void noise_cpu_model(char *cpu, size_t len)
+{
+	static const char * const keys[] = { "cpu model", "model name" };
+	char line[256];
+	char *val;
+	size_t i;
+	FILE *fp;
+
+	snprintf(cpu, len, "unknown");
+
+	fp = fopen("/proc/cpuinfo", "r");
+	if (!fp)
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+			if (strncmp(line, keys[i], strlen(keys[i])))
+				continue;
+
+			val = strchr(line, ':');
+			if (!val)
+				continue;
+
+			val += strspn(val, ": \t");
+			val[strcspn(val, "\t\n")] = '\0';
+			snprintf(cpu, len, "%s", val);
+			fclose(fp);
+			return;
+		}
+	}
+
+	fclose(fp);
+}
+
+static size_t noise_store_read(const char *store, struct noise_entry *e,
+			       size_t max)
+{
+	char line[NOISE_STORE_LINE];
+	char *tab;
+	size_t n = 0;
+	FILE *fp;
+
+	fp = fopen(store, "r");
+	if (!fp)
+		return 0;
+
+	while (n < max && fgets(line, sizeof(line), fp)) {
+		tab = strrchr(line, '\t');
+		if (!tab)
+			continue;
+
+		*tab++ = '\0';
+		snprintf(e[n].cpu, sizeof(e[n].cpu), "%.*s",
+			 (int)sizeof(e[n].cpu) - 1, line);
+		e[n].h = atof(tab);
+		if (e[n].h > 0)
+			n++;
+	}
+
+	fclose(fp);
+
+	return n;
+}
+
+static void noise_store_write(const char *store, struct noise_entry *e,
+			      size_t n)
+{
+	char tmp[256];
+	size_t i;
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", store);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		ERROR("cannot write %s: %s\n", tmp, strerror(errno));
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%s\t%.3f\n", e[i].cpu, e[i].h);
+
+	if (fclose(fp) || rename(tmp, store)) {
+		ERROR("cannot update %s: %s\n", store, strerror(errno));
+		unlink(tmp);
+	}
+}
+
+#ifdef URNGD_STATIC_ALLOC
+static uint64_t noise_calib[NOISE_CALIB_SAMPLES];
+#endif
+
+/*
+ * Run the startup estimator over the measurements of the collector ec and
+ * derive how much of its output may be credited, in per mille of injected
+ * bits. The lowest of this boot's estimate and the one stored for the same
+ * CPU model wins, then the safety margin (in percent) is taken off.
+ */
+unsigned int noise_credit_rate(struct rand_data *ec, const char *store,
+			       unsigned int osr, unsigned int margin)
+{
+	struct noise_entry e[NOISE_STORE_MAX];
+	char cpu[NOISE_CPU_LEN];
+	uint64_t *samples;
+	double h = -1, stored, rate;
+	bool fresh = false;
+	size_t i, n = 0;
+
+	noise_cpu_model(cpu, sizeof(cpu));
+
+#ifdef URNGD_STATIC_ALLOC
+	samples = noise_calib;
+#else
+	samples = calloc(NOISE_CALIB_SAMPLES, sizeof(*samples));
+#endif
+	if (samples && noise_sample(ec, samples, NOISE_CALIB_SAMPLES)) {
+		h = noise_min_entropy(samples, NOISE_CALIB_SAMPLES);
+		fresh = true;
+	}
+#ifndef URNGD_STATIC_ALLOC
+	free(samples);
+#endif
+
+	if (store)
+		n = noise_store_read(store, e, NOISE_STORE_MAX);
+
+	for (i = 0; i < n; i++)
+		if (!strcmp(e[i].cpu, cpu))
+			break;
+
+	if (i < n) {
+		stored = e[i].h;
+		DEBUG(1, "stored estimate for %s: %.3f bits/sample\n", cpu, stored);
+		/* only ever lowered, a lucky boot must not raise crediting */
+		if (h < 0 || stored < h)
+			h = stored;
+		e[i].h = h;
+	} else if (h >= 0 && n < NOISE_STORE_MAX) {
+		snprintf(e[n].cpu, sizeof(e[n].cpu), "%s", cpu);
+		e[n++].h = h;
+	}
+
+	if (h < 0) {
+		ERROR("no entropy estimate for %s, using default crediting\n", cpu);
+		return NOISE_CREDIT_DEFAULT;
+	}
+
+	if (store && fresh)
+		noise_store_write(store, e, n);
+
+	rate = h * osr;
+	if (rate > 1.0)
+		rate = 1.0;
+	if (margin > 100)
+		margin = 100;
+
+	rate *= 1000.0 * (100 - margin) / 100;
+
+	LOG("%s: %.2f bits/sample, crediting %.1f%% of injected bits\n",
+	    cpu, h, rate / 10);
+
+	return (unsigned int)rate;
+}
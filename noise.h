@@ -0,0 +1,48 @@
+/*
+ * Raw timing noise sampling and entropy estimation for urngd.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __NOISE_H
+#define __NOISE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* number of raw samples taken by the startup estimator */
+#define NOISE_CALIB_SAMPLES 4096
+
+/* crediting used when no estimate is available, per mille of injected bits */
+#define NOISE_CREDIT_DEFAULT 500
+
+struct rand_data;
+
+/* gets the time delta of a collector measurement, false stops recording */
+typedef bool (*noise_fn)(uint64_t delta, void *arg);
+
+uint64_t noise_nstime(void);
+void noise_watch(struct rand_data *ec);
+bool noise_record(struct rand_data *ec, noise_fn fn, void *arg);
+size_t noise_sample(struct rand_data *ec, uint64_t *deltas, size_t n);
+bool noise_quality(struct rand_data *ec, double *h, double *cost);
+ssize_t noise_read(void *buf, size_t len, unsigned int osr);
+bool noise_replay_open(const char *path);
+void noise_replay_close(void);
+double noise_min_entropy(uint64_t *samples, size_t n);
+#ifdef URNGD_DEBUG
+/* timer reads and measurements of the watched collectors, in timer ticks */
+struct noise_profile {
+	uint64_t reads;
+	uint64_t measurements;
+	uint64_t ticks;
+};
+
+void noise_profile(struct noise_profile *p);
+#endif
+unsigned int noise_credit_rate(struct rand_data *ec, const char *store,
+			       unsigned int osr, unsigned int margin);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Per-phase timing breakdown of jitter collection, debug builds only.
+ *
+ * The measurements of the collector are accounted from its own timer reads
+ * while gather_entropy() watches it, see noise.c: each covers a whole
+ * jent_measure_jitter() run with its memory access, folding and health
+ * test, and no extra time stamps are taken around them. The cost of one
+ * timer read and the length of a timer tick are taken at dump time over a
+ * run of back to back reads. Next to the measured jent_read_entropy() cost
+ * this tells how the collection time splits on a given board.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifdef URNGD_DEBUG
+
+#include <time.h>
+
+#include "log.h"
+#include "noise.h"
+#include "phase.h"
+#include "stats.h"
+#include "jitterentropy.h"
+
+#define PHASE_TIMER_READS 4096
+
+struct phase_acc {
+	uint64_t ns;
+	uint64_t count;
+};
+
+static struct phase_acc phase_acc[__PHASE_MAX];
+
+static const char * const phase_names[__PHASE_MAX] = {
+	[PHASE_SELFTEST] = "fips",
+};
+
+uint64_t phase_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void phase_add(enum phase p, uint64_t start)
+{
+	phase_acc[p].ns += phase_now() - start;
+	phase_acc[p].count++;
+}
+
+/* ns per read of the collector's timer and per tick it counts */
+static void phase_timer(double *read_ns, double *tick_ns)
+{
+	uint64_t start, end, first;
+	__u64 now;
+	unsigned int i;
+
+	start = phase_now();
+	jent_get_nstime(&now);
+	first = now;
+	for (i = 0; i < PHASE_TIMER_READS; i++)
+		jent_get_nstime(&now);
+	end = phase_now();
+
+	*read_ns = (double)(end - start) / (PHASE_TIMER_READS + 1);
+	*tick_ns = now > first ? (double)(end - start) / (now - first) : 0;
+}
+
+void phase_dump(const struct stats *s)
+{
+	const struct stats_hist *c = &s->collect;
+	struct noise_profile p;
+	double read_ns, tick_ns;
+	unsigned int i;
+
+	noise_profile(&p);
+	phase_timer(&read_ns, &tick_ns);
+
+	LOG("phases: jent_read_entropy avg %lluns over %llu calls\n",
+	    (unsigned long long)(c->count ? c->sum / c->count : 0),
+	    (unsigned long long)c->count);
+
+	if (p.measurements)
+		LOG("phases: %-9s avg %.0fns over %llu runs, %.1f timer reads each\n",
+		    "measure", p.ticks * tick_ns / p.measurements,
+		    (unsigned long long)p.measurements,
+		    (double)p.reads / p.measurements);
+
+	LOG("phases: %-9s avg %.0fns per read\n", "timer", read_ns);
+
+	for (i = 0; i < __PHASE_MAX; i++) {
+		if (!phase_acc[i].count)
+			continue;
+
+		LOG("phases: %-9s avg %lluns over %llu runs\n", phase_names[i],
+		    (unsigned long long)(phase_acc[i].ns / phase_acc[i].count),
+		    (unsigned long long)phase_acc[i].count);
+	}
+}
+
+#endif
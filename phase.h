@@ -0,0 +1,41 @@
+/*
+ * Per-phase timing breakdown of jitter collection, debug builds only.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __PHASE_H
+#define __PHASE_H
+
+#include <stdint.h>
+
+/* phases timed around the collector, its own measurements come from noise.c */
+enum phase {
+	/* FIPS 140-2 tests on the output */
+	PHASE_SELFTEST,
+	__PHASE_MAX
+};
+
+#ifdef URNGD_DEBUG
+
+#include "noise.h"
+
+struct stats;
+
+uint64_t phase_now(void);
+void phase_add(enum phase p, uint64_t start);
+void phase_dump(const struct stats *s);
+
+#define PHASE_START(var) uint64_t var = phase_now()
+#define PHASE_END(p, var) phase_add(p, var)
+#define PHASE_WATCH(ec) noise_watch(ec)
+
+#else
+
+#define PHASE_START(var) do {} while (0)
+#define PHASE_END(p, var) do {} while (0)
+#define PHASE_WATCH(ec) do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * USDT static probes, see README.md for the list of probes.
+ *
+ * With <sys/sdt.h> available each probe is a single nop plus a note in the
+ * ELF, so they cost nothing until a tracer attaches. Without it they are
+ * compiled out.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __PROBES_H
+#define __PROBES_H
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE(name) DTRACE_PROBE(urngd, name)
+#define PROBE1(name, a) DTRACE_PROBE1(urngd, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(urngd, name, a, b)
+#else
+#define PROBE(name) do {} while (0)
+#define PROBE1(name, a) do {} while (0)
+#define PROBE2(name, a, b) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Rate-limited, aggregated error reporting.
+ *
+ * Errors are keyed on their class and errno, each key with its own window.
+ * The first error of a key is logged as is and opens the window, repeats
+ * within the next RATELIMIT_WINDOW seconds are only counted and reported as
+ * a single summary line once the window is over.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include <libubox/uloop.h>
+
+#include "log.h"
+#include "ratelimit.h"
+
+struct ratelimit {
+	enum ratelimit_class c;
+	int err;
+	unsigned int count;
+	bool active;
+	/* CLOCK_MONOTONIC ms the window was opened at */
+	uint64_t start;
+};
+
+static const char * const ratelimit_names[__RL_MAX] = {
+	[RL_IOCTL] = "ioctl",
+	[RL_READ] = "read",
+	[RL_SHORT] = "short injection",
+	[RL_RESEED] = "reseed",
+};
+
+static struct ratelimit ratelimit[RATELIMIT_SLOTS];
+
+static void ratelimit_timeout_cb(struct uloop_timeout *t);
+static struct uloop_timeout ratelimit_timeout = {
+	.cb = ratelimit_timeout_cb,
+};
+
+static uint64_t ratelimit_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static const char *ratelimit_errname(int err, char *buf, size_t len)
+{
+	switch (err) {
+	case 0: return "";
+	case EPERM: return "EPERM";
+	case EINVAL: return "EINVAL";
+	case EINTR: return "EINTR";
+	case EAGAIN: return "EAGAIN";
+	case EBADF: return "EBADF";
+	case EFAULT: return "EFAULT";
+	case ENOMEM: return "ENOMEM";
+	case EIO: return "EIO";
+	case ENOTTY: return "ENOTTY";
+	case ENODATA: return "ENODATA";
+	}
+
+	snprintf(buf, len, "errno %d", err);
+
+	return buf;
+}
+
+static void ratelimit_report(struct ratelimit *r, uint64_t now)
+{
+	char buf[16];
+
+	if (r->count)
+		ERROR("%s%s%s x %u in last %llus\n", ratelimit_names[r->c],
+		      r->err ? " " : "", ratelimit_errname(r->err, buf, sizeof(buf)),
+		      r->count, (unsigned long long)(now - r->start + 999) / 1000);
+
+	r->count = 0;
+	r->active = false;
+}
+
+/* wake up when the oldest open window is over */
+static void ratelimit_arm(uint64_t now)
+{
+	uint64_t end = 0;
+	unsigned int i;
+
+	for (i = 0; i < RATELIMIT_SLOTS; i++)
+		if (ratelimit[i].active && (!end || ratelimit[i].start < end))
+			end = ratelimit[i].start;
+
+	if (!end) {
+		uloop_timeout_cancel(&ratelimit_timeout);
+		return;
+	}
+
+	end += RATELIMIT_WINDOW * 1000;
+	uloop_timeout_set(&ratelimit_timeout, end > now ? end - now : 0);
+}
+
+static void ratelimit_timeout_cb(struct uloop_timeout *t)
+{
+	uint64_t now = ratelimit_now();
+	unsigned int i;
+
+	for (i = 0; i < RATELIMIT_SLOTS; i++)
+		if (ratelimit[i].active &&
+		    now - ratelimit[i].start >= RATELIMIT_WINDOW * 1000)
+			ratelimit_report(&ratelimit[i], now);
+
+	ratelimit_arm(now);
+}
+
+void ratelimit_error(enum ratelimit_class c, int err, const char *fmt, ...)
+{
+	struct ratelimit *r, *slot = NULL;
+	uint64_t now = ratelimit_now();
+	char msg[256];
+	unsigned int i;
+	va_list ap;
+
+	for (i = 0; i < RATELIMIT_SLOTS; i++) {
+		r = &ratelimit[i];
+		if (!r->active) {
+			if (!slot || slot->active)
+				slot = r;
+			continue;
+		}
+
+		if (r->c == c && r->err == err) {
+			r->count++;
+			return;
+		}
+
+		if (!slot || (slot->active && r->start < slot->start))
+			slot = r;
+	}
+
+	/* all slots taken, close the oldest window early */
+	if (slot->active)
+		ratelimit_report(slot, now);
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	ERROR("%s", msg);
+
+	slot->c = c;
+	slot->err = err;
+	slot->start = now;
+	slot->active = true;
+
+	ratelimit_arm(now);
+}
+
+/* report whatever was suppressed so far and close all windows */
+void ratelimit_flush(void)
+{
+	uint64_t now = ratelimit_now();
+	unsigned int i;
+
+	uloop_timeout_cancel(&ratelimit_timeout);
+
+	for (i = 0; i < RATELIMIT_SLOTS; i++)
+		if (ratelimit[i].active)
+			ratelimit_report(&ratelimit[i], now);
+}
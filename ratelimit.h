@@ -0,0 +1,26 @@
+/*
+ * Rate-limited, aggregated error reporting.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __RATELIMIT_H
+#define __RATELIMIT_H
+
+#define RATELIMIT_WINDOW 60
+/* class and errno pairs tracked at the same time */
+#define RATELIMIT_SLOTS 8
+
+enum ratelimit_class {
+	RL_IOCTL,
+	RL_READ,
+	RL_SHORT,
+	RL_RESEED,
+	__RL_MAX
+};
+
+void ratelimit_error(enum ratelimit_class c, int err, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+void ratelimit_flush(void);
+
+#endif
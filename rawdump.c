@@ -0,0 +1,242 @@
+/*
+ * Raw noise sample capture for offline SP 800-90B assessment.
+ *
+ * The samples are the time deltas of the collector's own measurements, as
+ * handed out by noise_record(). They are collected into one buffer while a
+ * writer thread flushes the other one, so disk I/O never runs in between
+ * the timer reads.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "noise.h"
+#include "rawdump.h"
+
+#define RAWDUMP_CHUNK 16384
+
+struct rawdump_buf {
+	uint64_t s[RAWDUMP_CHUNK];
+	size_t len;
+	bool full;
+};
+
+struct rawdump {
+	struct rawdump_buf buf[2];
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* buffer being filled and samples left in the current run */
+	struct rawdump_buf *cur;
+	unsigned int i;
+	size_t left;
+	unsigned int stalls;
+	bool done;
+	int fd;
+	int err;
+};
+
+static int rawdump_write(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static void *rawdump_writer(void *arg)
+{
+	struct rawdump *rd = arg;
+	struct rawdump_buf *b;
+	unsigned int i = 0;
+
+	for (;;) {
+		b = &rd->buf[i];
+
+		pthread_mutex_lock(&rd->lock);
+		while (!b->full && !rd->done)
+			pthread_cond_wait(&rd->cond, &rd->lock);
+		pthread_mutex_unlock(&rd->lock);
+
+		if (!b->full)
+			break;
+
+		if (!rd->err)
+			rd->err = rawdump_write(rd->fd, b->s, b->len * sizeof(b->s[0]));
+
+		pthread_mutex_lock(&rd->lock);
+		b->full = false;
+		pthread_cond_broadcast(&rd->cond);
+		pthread_mutex_unlock(&rd->lock);
+
+		i ^= 1;
+	}
+
+	return NULL;
+}
+
+static void rawdump_submit(struct rawdump *rd, struct rawdump_buf *b)
+{
+	pthread_mutex_lock(&rd->lock);
+	b->full = true;
+	pthread_cond_broadcast(&rd->cond);
+	pthread_mutex_unlock(&rd->lock);
+}
+
+static struct rawdump_buf *rawdump_next(struct rawdump *rd, unsigned int i)
+{
+	struct rawdump_buf *b = &rd->buf[i];
+
+	pthread_mutex_lock(&rd->lock);
+	if (b->full)
+		rd->stalls++;
+	while (b->full)
+		pthread_cond_wait(&rd->cond, &rd->lock);
+	pthread_mutex_unlock(&rd->lock);
+
+	b->len = 0;
+
+	return b;
+}
+
+static bool rawdump_sample(uint64_t delta, void *arg)
+{
+	struct rawdump *rd = arg;
+	struct rawdump_buf *b = rd->cur;
+
+	b->s[b->len++] = delta;
+	if (b->len == RAWDUMP_CHUNK) {
+		rawdump_submit(rd, b);
+		rd->i ^= 1;
+		rd->cur = rawdump_next(rd, rd->i);
+	}
+
+	return --rd->left > 0;
+}
+
+static bool rawdump_capture(struct rawdump *rd, size_t samples, bool restarts,
+			    rawdump_collector_fn collector)
+{
+	struct rand_data *ec = NULL;
+	unsigned int r, runs = 1;
+	size_t seg = samples;
+	bool ok = true;
+
+	if (restarts) {
+		runs = RAWDUMP_RESTARTS;
+		seg = samples / RAWDUMP_RESTARTS;
+	}
+
+	rd->i = 0;
+	rd->cur = rawdump_next(rd, rd->i);
+
+	for (r = 0; r < runs && seg && ok; r++) {
+		if (restarts || !ec)
+			ec = collector();
+		if (!ec) {
+			ok = false;
+			break;
+		}
+
+		rd->left = seg;
+		ok = noise_record(ec, rawdump_sample, rd);
+	}
+
+	if (rd->cur->len)
+		rawdump_submit(rd, rd->cur);
+
+	if (!ok)
+		ERROR("collector failed during the raw dump\n");
+
+	return ok;
+}
+
+/*
+ * Write native endian 64-bit time deltas to path, either as one sequential
+ * run or as RAWDUMP_RESTARTS runs, each one on a fresh collector. The
+ * collector callback hands out a freshly allocated collector every time
+ * it's called.
+ */
+bool rawdump_run(const char *path, size_t samples, bool restarts,
+		 rawdump_collector_fn collector)
+{
+	struct timespec start, end;
+	struct rawdump *rd;
+	pthread_t writer;
+	unsigned int ms;
+	bool ok = false;
+
+	rd = calloc(1, sizeof(*rd));
+	if (!rd) {
+		ERROR("raw dump alloc failed\n");
+		return false;
+	}
+
+	rd->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (rd->fd < 0) {
+		ERROR("cannot open %s: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	pthread_mutex_init(&rd->lock, NULL);
+	pthread_cond_init(&rd->cond, NULL);
+
+	if (pthread_create(&writer, NULL, rawdump_writer, rd)) {
+		ERROR("cannot start raw dump writer\n");
+		goto out_close;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ok = rawdump_capture(rd, samples, restarts, collector);
+
+	pthread_mutex_lock(&rd->lock);
+	rd->done = true;
+	pthread_cond_broadcast(&rd->cond);
+	pthread_mutex_unlock(&rd->lock);
+	pthread_join(writer, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (rd->err) {
+		ERROR("cannot write %s: %s\n", path, strerror(rd->err));
+		ok = false;
+	}
+
+	if (!ok)
+		goto out_close;
+
+	ms = (end.tv_sec - start.tv_sec) * 1000 +
+	     (end.tv_nsec - start.tv_nsec) / 1000000;
+	LOG("wrote %zu %s samples to %s in %u.%03us, %u writer stalls\n",
+	    restarts ? samples / RAWDUMP_RESTARTS * RAWDUMP_RESTARTS : samples,
+	    restarts ? "restart" : "sequential", path, ms / 1000, ms % 1000,
+	    rd->stalls);
+
+out_close:
+	pthread_cond_destroy(&rd->cond);
+	pthread_mutex_destroy(&rd->lock);
+	close(rd->fd);
+out:
+	free(rd);
+
+	return ok;
+}
@@ -0,0 +1,26 @@
+/*
+ * Raw noise sample capture for offline SP 800-90B assessment.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __RAWDUMP_H
+#define __RAWDUMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* SP 800-90B asks for 1 000 000 sequential samples... */
+#define RAWDUMP_SAMPLES 1000000
+/* ...and for 1000 restarts of 1000 samples each */
+#define RAWDUMP_RESTARTS 1000
+
+struct rand_data;
+
+/* a freshly allocated collector, the previous one is no longer used */
+typedef struct rand_data *(*rawdump_collector_fn)(void);
+
+bool rawdump_run(const char *path, size_t samples, bool restarts,
+		 rawdump_collector_fn collector);
+
+#endif
@@ -0,0 +1,399 @@
+/*
+ * Seed journal carrying entropy across reboots.
+ *
+ * The seed is mixed into the kernel right at startup, long before the
+ * collector has finished its power-on self-test. It is credited only if
+ * asked for and the file is private to its owner.
+ *
+ * To spare flash erase cycles the file is a journal: a preallocated region
+ * of small checksummed records, each carrying a whole seed and a sequence
+ * number, and flagged creditable only if its seed was taken from a ready
+ * CRNG. An update appends one record in place, which jffs2 and ubifs turn
+ * into a single small node instead of a rewrite of the file. Only when the
+ * region is full it is compacted, written anew via a synced temporary file
+ * and a rename, starting over with the latest record. At startup the valid
+ * record with the highest sequence number wins.
+ *
+ * A new record is appended right after loading, so no seed is ever used
+ * twice, then whenever the collector has credited as much entropy as a
+ * record holds, but at most once per interval, and on shutdown. Each new
+ * seed is read from the kernel after our own input went in. Until the CRNG
+ * is ready a single uncreditable stand-in supersedes the used seed and the
+ * write is retried on every credited injection.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/random.h>
+
+#include "log.h"
+#include "arena.h"
+#include "seed.h"
+#include "sink.h"
+#include "stats.h"
+
+#define SEED_MAGIC 0x75736564
+#define SEED_DATA 112
+/* seed taken from a ready CRNG, may be credited */
+#define SEED_CREDITABLE (1 << 0)
+#define SEED_JOURNAL_SIZE (16 * 1024)
+#define SEED_RECORDS (SEED_JOURNAL_SIZE / sizeof(struct seed_record))
+
+struct seed_record {
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t flags;
+	uint8_t data[SEED_DATA];
+	uint32_t crc;
+};
+
+/* everything carrying seed material, kept in the locked arena */
+struct seed_scratch {
+	struct seed_record r;
+	struct seed_record cur;
+	union {
+		struct rand_pool_info rpi;
+		char pool[sizeof(struct rand_pool_info) + SEED_DATA];
+	};
+};
+
+static struct {
+	const char *path;
+	struct sink *sink;
+	unsigned int interval;
+	struct stats *stats;
+	/* slot and sequence number of the next record */
+	unsigned int next;
+	uint32_t seq;
+	uint64_t last;
+	size_t credited;
+	/* a record is due but the CRNG was not ready yet */
+	bool pending;
+	/* the latest record is an uncreditable stand-in */
+	bool standin;
+	struct seed_scratch *s;
+} seed;
+
+static inline void seed_wipe(void *p, size_t len)
+{
+	memset(p, 0, len);
+	__asm__ __volatile__("" : : "r" (p) : "memory");
+}
+
+static uint32_t seed_crc32(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t crc = ~0U;
+	unsigned int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static bool seed_valid(const struct seed_record *r)
+{
+	return r->magic == SEED_MAGIC &&
+	       r->crc == seed_crc32(r, offsetof(struct seed_record, crc));
+}
+
+/* returns the number of bits credited or -1 if the seed could not be mixed */
+static int seed_inject(const unsigned char *buf, size_t len, unsigned int bits)
+{
+	struct rand_pool_info *rpi = &seed.s->rpi;
+	int ret;
+
+	rpi->entropy_count = bits;
+	rpi->buf_size = len;
+	memcpy(rpi->buf, buf, len);
+
+	ret = sink_inject(seed.sink, rpi);
+	if (ret < 0 && bits) {
+		ERROR("crediting seed failed: %s\n", strerror(errno));
+		bits = rpi->entropy_count = 0;
+		ret = sink_inject(seed.sink, rpi);
+	}
+
+	seed_wipe(seed.s->pool, sizeof(seed.s->pool));
+
+	return ret < 0 ? -1 : (int)bits;
+}
+
+/* start over with a fresh region holding just r */
+static bool seed_compact(const struct seed_record *r)
+{
+	static const char zero[sizeof(*r)];
+	char tmp[256], dir[256];
+	unsigned int i;
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", seed.path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		ERROR("cannot write %s: %s\n", tmp, strerror(errno));
+		return false;
+	}
+
+	for (i = 0; i < SEED_RECORDS; i++)
+		if (write(fd, i ? zero : (const char *)r, sizeof(*r)) !=
+		    sizeof(*r))
+			break;
+
+	if (i < SEED_RECORDS || fsync(fd) || close(fd) ||
+	    rename(tmp, seed.path)) {
+		ERROR("cannot update %s: %s\n", seed.path, strerror(errno));
+		unlink(tmp);
+		return false;
+	}
+
+	snprintf(dir, sizeof(dir), "%s", seed.path);
+	fd = open(dirname(dir), O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+
+	seed.next = 1;
+	DEBUG(1, "seed journal %s compacted\n", seed.path);
+
+	return true;
+}
+
+static bool seed_append(const struct seed_record *r)
+{
+	bool ret;
+	int fd;
+
+	if (seed.next >= SEED_RECORDS)
+		return false;
+
+	fd = open(seed.path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	ret = pwrite(fd, r, sizeof(*r), seed.next * sizeof(*r)) == sizeof(*r) &&
+	      !fdatasync(fd);
+	close(fd);
+
+	if (ret)
+		seed.next++;
+
+	return ret;
+}
+
+static bool seed_urandom(void *buf, size_t len)
+{
+	ssize_t ret = -1;
+	int fd;
+
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		ret = read(fd, buf, len);
+		close(fd);
+	}
+
+	return ret == (ssize_t)len;
+}
+
+/* 1 with fresh seed material, 0 if the CRNG is not ready yet, -1 on errors */
+static int seed_random(void *buf, size_t len)
+{
+#ifdef SYS_getrandom
+	ssize_t ret = syscall(SYS_getrandom, buf, len, GRND_NONBLOCK);
+
+	if (ret == (ssize_t)len)
+		return 1;
+	if (ret < 0 && errno == EAGAIN)
+		return 0;
+	if (ret >= 0 || errno != ENOSYS)
+		return -1;
+#endif
+
+	/* no getrandom(), no telling whether the CRNG is ready */
+	return seed_urandom(buf, len) ? 1 : -1;
+}
+
+static void seed_save(void)
+{
+	struct seed_record *r = &seed.s->r;
+	int ret;
+
+	if (!seed.path)
+		return;
+
+	memset(r, 0, sizeof(*r));
+	r->magic = SEED_MAGIC;
+	r->seq = seed.seq + 1;
+
+	ret = seed_random(r->data, sizeof(r->data));
+	if (!ret) {
+		seed.pending = true;
+
+		/* one stand-in keeps the used seed from coming back */
+		if (seed.standin) {
+			seed_wipe(r, sizeof(*r));
+			return;
+		}
+
+		if (!seed_urandom(r->data, sizeof(r->data)))
+			ret = -1;
+		else
+			LOG("CRNG not ready, writing an uncreditable seed record\n");
+	} else if (ret > 0) {
+		r->flags = SEED_CREDITABLE;
+		seed.pending = false;
+	}
+
+	if (ret < 0) {
+		ERROR("cannot read a new seed: %s\n", strerror(errno));
+		seed.pending = true;
+		seed_wipe(r, sizeof(*r));
+		return;
+	}
+
+	r->crc = seed_crc32(r, offsetof(struct seed_record, crc));
+
+	if (seed_append(r) || seed_compact(r)) {
+		seed.standin = !ret;
+		seed.seq = r->seq;
+		seed.last = stats_now_ns();
+		seed.credited = 0;
+		if (seed.stats)
+			seed.stats->flash_writes++;
+		DEBUG(1, "seed record %u written\n", r->seq);
+	}
+
+	seed_wipe(r, sizeof(*r));
+}
+
+/* find the latest valid record, leave it in r */
+static bool seed_journal_read(int fd, struct seed_record *r)
+{
+	struct seed_record *cur = &seed.s->cur;
+	unsigned int i;
+	bool found = false;
+
+	for (i = 0; i < SEED_RECORDS; i++) {
+		if (read(fd, cur, sizeof(*cur)) != sizeof(*cur))
+			break;
+
+		if (!seed_valid(cur) || (found && cur->seq <= r->seq))
+			continue;
+
+		*r = *cur;
+		seed.next = i + 1;
+		found = true;
+	}
+
+	seed_wipe(cur, sizeof(*cur));
+
+	/* appending to a short or foreign file would not be found again */
+	if (i < SEED_RECORDS)
+		seed.next = SEED_RECORDS;
+
+	return found;
+}
+
+/* returns the number of bits credited */
+size_t seed_load(const char *path, unsigned int credit, unsigned int interval,
+		 struct stats *stats, struct sink *sink)
+{
+	struct seed_record *r;
+	struct stat st;
+	bool found;
+	int fd, ret;
+
+	seed.s = arena_alloc(sizeof(*seed.s));
+	if (!seed.s) {
+		ERROR("seed buffer alloc failed\n");
+		return 0;
+	}
+
+	r = &seed.s->r;
+	seed.path = path;
+	seed.sink = sink;
+	seed.interval = interval;
+	seed.stats = stats;
+	seed.next = SEED_RECORDS;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			ERROR("cannot open %s: %s\n", path, strerror(errno));
+		seed_save();
+		return 0;
+	}
+
+	found = seed_journal_read(fd, r);
+	if (found && credit && (fstat(fd, &st) || st.st_mode & 077)) {
+		ERROR("%s is accessible by others, not crediting it\n", path);
+		credit = 0;
+	}
+	if (found && credit && !(r->flags & SEED_CREDITABLE)) {
+		LOG("seed record %u was taken before the CRNG was ready, "
+		    "not crediting it\n", r->seq);
+		credit = 0;
+	}
+	close(fd);
+
+	if (credit > SEED_DATA * 8)
+		credit = SEED_DATA * 8;
+
+	ret = found ? seed_inject(r->data, sizeof(r->data), credit) : -1;
+	seed.seq = found ? r->seq : 0;
+	seed_wipe(r, sizeof(*r));
+
+	if (ret < 0) {
+		ERROR("no seed mixed from %s\n", path);
+		credit = 0;
+	} else {
+		credit = ret;
+		LOG("mixed seed record %u from %s, %u bits credited\n",
+		    seed.seq, path, credit);
+	}
+
+	/* never let the next boot see the same seed */
+	seed_save();
+
+	return credit;
+}
+
+/* on shutdown, keep what was credited since the last record */
+void seed_done(void)
+{
+	if (seed.path && (seed.credited || seed.pending))
+		seed_save();
+
+	arena_free(seed.s);
+	seed.s = NULL;
+	seed.path = NULL;
+}
+
+/* refresh the seed once the collector made up for what a record carries */
+void seed_credited(size_t bits)
+{
+	if (!seed.path)
+		return;
+
+	seed.credited += bits;
+	if (!seed.pending && (seed.credited < SEED_DATA * 8 ||
+	    stats_now_ns() - seed.last < seed.interval * 1000000000ULL))
+		return;
+
+	seed_save();
+}
@@ -0,0 +1,23 @@
+/*
+ * Seed journal carrying entropy across reboots.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __SEED_H
+#define __SEED_H
+
+#include <stddef.h>
+
+/* default minimum time between two seed writes, in seconds */
+#define SEED_INTERVAL (60 * 60)
+
+struct sink;
+struct stats;
+
+size_t seed_load(const char *path, unsigned int credit, unsigned int interval,
+		 struct stats *stats, struct sink *sink);
+void seed_credited(size_t bits);
+void seed_done(void);
+
+#endif
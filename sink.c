@@ -0,0 +1,196 @@
+/*
+ * Entropy sinks: the kernel pool or a simulated one for load testing.
+ *
+ * The simulated pool runs in a child process at the other end of a
+ * socketpair. Injections are sent to it as the very same rand_pool_info
+ * the ioctl would get, it drains its level at a fixed rate and, just like
+ * /dev/random, makes the socket readable whenever the level drops below
+ * the wakeup threshold. That way the whole low_entropy_cb() to
+ * write_entropy() path runs unprivileged and at any event rate.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/random.h>
+
+#include "log.h"
+#include "sink.h"
+
+#define DEV_RANDOM "/dev/random"
+
+#ifndef RNDRESEEDCRNG
+#define RNDRESEEDCRNG _IO('R', 0x07)
+#endif
+#define SIM_POOL_BITS 4096
+#define SIM_MSG_MAX 512
+
+static int sink_kernel_inject(struct sink *s, struct rand_pool_info *rpi)
+{
+	return ioctl(s->fd, RNDADDENTROPY, rpi);
+}
+
+static int sink_kernel_reseed(struct sink *s)
+{
+	return ioctl(s->fd, RNDRESEEDCRNG);
+}
+
+static void sink_kernel_close(struct sink *s)
+{
+	close(s->fd);
+	s->fd = -1;
+}
+
+static const struct sink_ops sink_kernel_ops = {
+	.inject = sink_kernel_inject,
+	.reseed = sink_kernel_reseed,
+	.close = sink_kernel_close,
+};
+
+bool sink_kernel_open(struct sink *s)
+{
+	s->fd = open(DEV_RANDOM, O_WRONLY);
+	if (s->fd < 1) {
+		ERROR(DEV_RANDOM " open failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	s->ops = &sink_kernel_ops;
+
+	return true;
+}
+
+static double sim_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sim_run(int fd, unsigned int drain, unsigned int thresh)
+{
+	char msg[SIM_MSG_MAX];
+	struct rand_pool_info *rpi = (struct rand_pool_info *)msg;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	unsigned long long injections = 0, wakeups = 0, bits = 0;
+	double start, last, now, below = 0, level = 0;
+	bool notified = false;
+	ssize_t len;
+
+	start = last = sim_now();
+
+	for (;;) {
+		now = sim_now();
+		if (level < thresh)
+			below += now - last;
+		level -= drain * (now - last);
+		if (level < 0)
+			level = 0;
+		last = now;
+
+		if (level < thresh && !notified) {
+			if (send(fd, "w", 1, MSG_DONTWAIT) == 1)
+				wakeups++;
+			notified = true;
+		}
+
+		if (poll(&pfd, 1, 1) <= 0)
+			continue;
+
+		len = recv(fd, msg, sizeof(msg), 0);
+		if (len <= 0)
+			break;
+
+		if ((size_t)len < sizeof(*rpi))
+			continue;
+
+		injections++;
+		bits += rpi->entropy_count;
+		level += rpi->entropy_count;
+		if (level > SIM_POOL_BITS)
+			level = SIM_POOL_BITS;
+		notified = false;
+	}
+
+	now = sim_now() - start;
+	LOG("sim: %.1fs, %llu injections (%.0f/s), %llu wakeups, %llu bits "
+	    "credited, below %u bits %.1f%% of the time\n", now, injections,
+	    now > 0 ? injections / now : 0, wakeups, bits, thresh,
+	    now > 0 ? below * 100 / now : 0);
+}
+
+static int sink_sim_inject(struct sink *s, struct rand_pool_info *rpi)
+{
+	size_t len = sizeof(*rpi) + rpi->buf_size;
+
+	return send(s->fd, rpi, len, 0) == (ssize_t)len ? 0 : -1;
+}
+
+static void sink_sim_ack(struct sink *s)
+{
+	char c[64];
+
+	while (recv(s->fd, c, sizeof(c), MSG_DONTWAIT) > 0)
+		;
+}
+
+static void sink_sim_close(struct sink *s)
+{
+	close(s->fd);
+	s->fd = -1;
+	waitpid(s->pid, NULL, 0);
+}
+
+static const struct sink_ops sink_sim_ops = {
+	.inject = sink_sim_inject,
+	.ack = sink_sim_ack,
+	.close = sink_sim_close,
+};
+
+/* simulated pool draining drain bits/s and signalling below thresh bits */
+bool sink_sim_open(struct sink *s, unsigned int drain, unsigned int thresh)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+		ERROR("socketpair failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	s->pid = fork();
+	if (s->pid < 0) {
+		ERROR("fork failed: %s\n", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+
+	if (!s->pid) {
+		close(sv[0]);
+		signal(SIGINT, SIG_IGN);
+		signal(SIGTERM, SIG_IGN);
+		sim_run(sv[1], drain, thresh);
+		_exit(0);
+	}
+
+	close(sv[1]);
+	s->fd = sv[0];
+	s->ops = &sink_sim_ops;
+
+	LOG("simulated pool draining %u bits/s, wakeup below %u bits\n",
+	    drain, thresh);
+
+	return true;
+}
@@ -0,0 +1,66 @@
+/*
+ * Entropy sinks: the kernel pool or a simulated one for load testing.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __SINK_H
+#define __SINK_H
+
+#include <stdbool.h>
+#include <errno.h>
+#include <sys/types.h>
+
+struct rand_pool_info;
+struct sink;
+
+struct sink_ops {
+	/* returns < 0 with errno set on failure, like the ioctl */
+	int (*inject)(struct sink *s, struct rand_pool_info *rpi);
+	/* consume the low entropy notification after a wakeup */
+	void (*ack)(struct sink *s);
+	/* push the pool's entropy into the CRNG right away, NULL if none */
+	int (*reseed)(struct sink *s);
+	void (*close)(struct sink *s);
+};
+
+struct sink {
+	const struct sink_ops *ops;
+	/* becomes readable when the pool runs low */
+	int fd;
+	pid_t pid;
+};
+
+bool sink_kernel_open(struct sink *s);
+bool sink_sim_open(struct sink *s, unsigned int drain, unsigned int thresh);
+
+static inline int sink_inject(struct sink *s, struct rand_pool_info *rpi)
+{
+	return s->ops->inject(s, rpi);
+}
+
+static inline void sink_ack(struct sink *s)
+{
+	if (s->ops->ack)
+		s->ops->ack(s);
+}
+
+/* fails with EOPNOTSUPP on a pool without a CRNG, like the simulated one */
+static inline int sink_reseed(struct sink *s)
+{
+	if (!s->ops->reseed) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	return s->ops->reseed(s);
+}
+
+static inline void sink_close(struct sink *s)
+{
+	if (s->ops)
+		s->ops->close(s);
+	s->ops = NULL;
+}
+
+#endif
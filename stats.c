@@ -0,0 +1,74 @@
+/*
+ * Runtime counters and latency histograms of the injection path.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "log.h"
+#include "stats.h"
+
+uint64_t stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_hist_add(struct stats_hist *h, uint64_t ns)
+{
+	unsigned int i = ns ? 64 - __builtin_clzll(ns) : 0;
+
+	if (i >= STATS_BUCKETS)
+		i = STATS_BUCKETS - 1;
+
+	h->bucket[i]++;
+	h->count++;
+	h->sum += ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+static void stats_hist_dump(const char *name, const struct stats_hist *h)
+{
+	char buf[STATS_BUCKETS * 16];
+	size_t len = 0;
+	unsigned int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < STATS_BUCKETS && len < sizeof(buf); i++) {
+		if (!h->bucket[i])
+			continue;
+
+		len += snprintf(buf + len, sizeof(buf) - len, " <2^%u:%u",
+				i, h->bucket[i]);
+	}
+
+	LOG("%s: n %llu, avg %lluns, max %lluns,%s\n", name,
+	    (unsigned long long)h->count,
+	    (unsigned long long)(h->count ? h->sum / h->count : 0),
+	    (unsigned long long)h->max, buf);
+}
+
+void stats_dump(const struct stats *s)
+{
+	LOG("wakeups %llu, injected %lluB, credited %llu bits, "
+	    "failures: ioctl %llu, read %llu, fips %llu, recoveries %llu, "
+	    "flash writes %llu, reseeds %llu\n",
+	    (unsigned long long)s->wakeups,
+	    (unsigned long long)s->injected_bytes,
+	    (unsigned long long)s->credited_bits,
+	    (unsigned long long)s->ioctl_failures,
+	    (unsigned long long)s->read_failures,
+	    (unsigned long long)s->fips_failures,
+	    (unsigned long long)s->recoveries,
+	    (unsigned long long)s->flash_writes,
+	    (unsigned long long)s->reseeds);
+
+	stats_hist_dump("wakeup to credit", &s->wakeup_credit);
+	stats_hist_dump("jitter collection", &s->collect);
+	stats_hist_dump("ioctl", &s->ioctl);
+}
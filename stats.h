@@ -0,0 +1,51 @@
+/*
+ * Runtime counters and latency histograms of the injection path.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdint.h>
+
+/* bucket i counts latencies below 2^i ns, the last one everything above */
+#define STATS_BUCKETS 32
+
+struct stats_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint32_t bucket[STATS_BUCKETS];
+};
+
+struct stats {
+	uint64_t wakeups;
+	uint64_t injected_bytes;
+	uint64_t credited_bits;
+	uint64_t ioctl_failures;
+	uint64_t read_failures;
+	uint64_t fips_failures;
+	uint64_t recoveries;
+	/* seed journal records and compactions written */
+	uint64_t flash_writes;
+	/* RNDRESEEDCRNG issued */
+	uint64_t reseeds;
+	/* kernel entropy level at the last wakeup, in bits */
+	uint64_t entropy_avail;
+
+	/* low entropy signalled until entropy credited */
+	struct stats_hist wakeup_credit;
+	/* jent_read_entropy() */
+	struct stats_hist collect;
+	/* RNDADDENTROPY */
+	struct stats_hist ioctl;
+	/* kernel entropy level samples, in bits rather than ns */
+	struct stats_hist entropy_level;
+};
+
+uint64_t stats_now_ns(void);
+void stats_hist_add(struct stats_hist *h, uint64_t ns);
+void stats_dump(const struct stats *s);
+
+#endif
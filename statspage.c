@@ -0,0 +1,92 @@
+/*
+ * Read-only statistics page shared with external monitoring.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "stats.h"
+#include "statspage.h"
+
+static struct statspage *page;
+static size_t page_len;
+static const char *page_path;
+
+bool statspage_open(const char *path)
+{
+	int fd;
+
+	page_len = sysconf(_SC_PAGESIZE);
+	if (page_len < sizeof(*page))
+		page_len = sizeof(*page);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		ERROR("cannot create %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	if (ftruncate(fd, page_len)) {
+		ERROR("cannot size %s: %s\n", path, strerror(errno));
+		goto err;
+	}
+
+	page = mmap(NULL, page_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED) {
+		ERROR("cannot map %s: %s\n", path, strerror(errno));
+		page = NULL;
+		goto err;
+	}
+
+	close(fd);
+
+	page->size = sizeof(*page);
+	page->version = STATSPAGE_VERSION;
+	__atomic_store_n(&page->magic, STATSPAGE_MAGIC, __ATOMIC_RELEASE);
+	page_path = path;
+
+	return true;
+
+err:
+	close(fd);
+	unlink(path);
+	return false;
+}
+
+void statspage_update(const struct stats *s)
+{
+	struct statspage_data d = {
+		.wakeups = s->wakeups,
+		.injected_bytes = s->injected_bytes,
+		.credited_bits = s->credited_bits,
+		.errors = s->ioctl_failures + s->read_failures + s->fips_failures,
+		.collect_ns = s->collect.sum,
+		.collect_count = s->collect.count,
+		.updated_ns = stats_now_ns(),
+	};
+	uint32_t seq;
+
+	if (!page)
+		return;
+
+	seq = page->seq;
+	__atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&page->data, &d, sizeof(d));
+	__atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void statspage_close(void)
+{
+	if (!page)
+		return;
+
+	munmap(page, page_len);
+	unlink(page_path);
+	page = NULL;
+}
@@ -0,0 +1,70 @@
+/*
+ * Read-only statistics page shared with external monitoring.
+ *
+ * The page is a plain file under /var/run which readers mmap() and
+ * snapshot with statspage_read() below, without any syscall and without
+ * talking to urngd. Fields are only ever appended, bumping the version.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __STATSPAGE_H
+#define __STATSPAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define STATSPAGE_PATH "/var/run/urngd.stats"
+#define STATSPAGE_MAGIC 0x55524e47
+#define STATSPAGE_VERSION 1
+
+struct statspage_data {
+	uint64_t wakeups;
+	uint64_t injected_bytes;
+	uint64_t credited_bits;
+	uint64_t errors;
+	/* total and count of jent_read_entropy() calls, in ns */
+	uint64_t collect_ns;
+	uint64_t collect_count;
+	/* CLOCK_MONOTONIC time of the last update, in ns */
+	uint64_t updated_ns;
+};
+
+struct statspage {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	/* odd while an update is in progress */
+	uint32_t seq;
+	struct statspage_data data;
+};
+
+/* consistent snapshot of a mapped page, false if it is not an urngd one */
+static inline bool statspage_read(const struct statspage *p,
+				  struct statspage_data *d)
+{
+	uint32_t seq;
+
+	if (p->magic != STATSPAGE_MAGIC || p->version < STATSPAGE_VERSION)
+		return false;
+
+	do {
+		do {
+			seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+		} while (seq & 1);
+
+		memcpy(d, (const void *)&p->data, sizeof(*d));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq != __atomic_load_n(&p->seq, __ATOMIC_RELAXED));
+
+	return true;
+}
+
+struct stats;
+
+bool statspage_open(const char *path);
+void statspage_update(const struct stats *s);
+void statspage_close(void);
+
+#endif
@@ -0,0 +1,295 @@
+/*
+ * In-memory trace ring for debug messages, debug builds only.
+ *
+ * With -t <entries>, DEBUG() messages go into a fixed ring of up to
+ * TRACE_ENTRIES timestamped slots instead of the log, which keeps syscalls
+ * off the hot path and the kernel log readable. Like the kernel's binary
+ * printk, tracing only stores the format, which has to be a literal, and
+ * the raw arguments: up to TRACE_ARGS of them, strings copied into
+ * TRACE_STR bytes and no '*' widths. Formatting is left to trace_dump().
+ * Slots are claimed with an atomic increment, so any thread may trace; the
+ * ring is dumped on SIGUSR1.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifdef URNGD_DEBUG
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "trace.h"
+
+/* argument sizes by length modifier, as va_arg() has to read them */
+enum trace_size {
+	TRACE_INT,
+	TRACE_LONG,
+	TRACE_LLONG,
+	TRACE_SIZE,
+	TRACE_PTRDIFF,
+	TRACE_INTMAX,
+};
+
+struct trace_spec {
+	/* bytes of the conversion, '%' included */
+	size_t len;
+	char conv;
+	enum trace_size size;
+	bool star;
+};
+
+struct trace_entry {
+	/* index + 1 once the entry is complete, 0 while it is written */
+	uint32_t seq;
+	uint32_t level;
+	uint64_t ts;
+	const char *fmt;
+	/* integers, pointers, doubles' bits and offsets into str */
+	uint64_t arg[TRACE_ARGS];
+	char str[TRACE_STR];
+};
+
+bool trace_enabled;
+
+static struct trace_entry trace_ring[TRACE_ENTRIES];
+static uint32_t trace_entries = TRACE_ENTRIES;
+static uint32_t trace_head;
+
+/* 0 or anything beyond TRACE_ENTRIES uses the whole ring */
+void trace_init(unsigned int entries)
+{
+	if (entries && entries < TRACE_ENTRIES)
+		trace_entries = entries;
+
+	trace_enabled = true;
+}
+
+/* the conversion at fmt, which points at its '%' */
+static void trace_spec(const char *fmt, struct trace_spec *s)
+{
+	const char *p = fmt + 1;
+
+	s->size = TRACE_INT;
+	s->star = false;
+
+	for (; *p && strchr("-+ #0123456789.*", *p); p++)
+		if (*p == '*')
+			s->star = true;
+
+	for (; *p && strchr("hlLqjzt", *p); p++) {
+		switch (*p) {
+		case 'l':
+			s->size = s->size == TRACE_LONG ? TRACE_LLONG : TRACE_LONG;
+			break;
+		case 'L':
+		case 'q':
+			s->size = TRACE_LLONG;
+			break;
+		case 'j':
+			s->size = TRACE_INTMAX;
+			break;
+		case 'z':
+			s->size = TRACE_SIZE;
+			break;
+		case 't':
+			s->size = TRACE_PTRDIFF;
+			break;
+		}
+	}
+
+	s->conv = *p;
+	s->len = p - fmt + !!*p;
+}
+
+static bool trace_is_double(char conv)
+{
+	return conv && strchr("aAeEfFgG", conv);
+}
+
+static uint64_t trace_int(va_list *ap, enum trace_size size)
+{
+	switch (size) {
+	case TRACE_LONG:
+		return va_arg(*ap, unsigned long);
+	case TRACE_LLONG:
+		return va_arg(*ap, unsigned long long);
+	case TRACE_SIZE:
+		return va_arg(*ap, size_t);
+	case TRACE_PTRDIFF:
+		return va_arg(*ap, ptrdiff_t);
+	case TRACE_INTMAX:
+		return va_arg(*ap, uintmax_t);
+	default:
+		return va_arg(*ap, unsigned int);
+	}
+}
+
+/* store the arguments fmt takes, stops at the first one it cannot */
+static void trace_args(struct trace_entry *e, const char *fmt, va_list *ap)
+{
+	struct trace_spec s;
+	unsigned int n = 0;
+	size_t str = 0, len;
+	const char *p;
+	double d;
+
+	for (p = strchr(fmt, '%'); p; p = strchr(p + s.len, '%')) {
+		trace_spec(p, &s);
+		if (s.conv == '%')
+			continue;
+
+		if (n == TRACE_ARGS || s.star || !s.conv)
+			return;
+
+		if (s.conv == 's') {
+			const char *arg = va_arg(*ap, const char *);
+
+			/* once full, they all share the final '\0' */
+			len = arg ? strnlen(arg, TRACE_STR - 1 - str) : 0;
+			memcpy(e->str + str, arg, len);
+			e->str[str + len] = '\0';
+			e->arg[n++] = str;
+			str = str + len + 1 < TRACE_STR ? str + len + 1 : TRACE_STR - 1;
+		} else if (trace_is_double(s.conv)) {
+			d = va_arg(*ap, double);
+			memcpy(&e->arg[n++], &d, sizeof(d));
+		} else if (s.conv == 'p') {
+			e->arg[n++] = (uintptr_t)va_arg(*ap, void *);
+		} else {
+			e->arg[n++] = trace_int(ap, s.size);
+		}
+	}
+}
+
+void trace_printf(unsigned int level, const char *fmt, ...)
+{
+	uint32_t idx = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+	struct trace_entry *e = &trace_ring[idx % trace_entries];
+	struct timespec ts;
+	va_list ap;
+
+	__atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	e->ts = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	e->level = level;
+	e->fmt = fmt;
+
+	va_start(ap, fmt);
+	trace_args(e, fmt, &ap);
+	va_end(ap);
+
+	__atomic_store_n(&e->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/* one conversion of spec with a stored argument */
+static int trace_conv(char *buf, size_t size, const char *spec,
+		      const struct trace_spec *s, const struct trace_entry *e,
+		      uint64_t arg)
+{
+	double d;
+
+	if (s->conv == 's')
+		return snprintf(buf, size, spec, e->str + arg);
+
+	if (trace_is_double(s->conv)) {
+		memcpy(&d, &arg, sizeof(d));
+		return snprintf(buf, size, spec, d);
+	}
+
+	if (s->conv == 'p')
+		return snprintf(buf, size, spec, (void *)(uintptr_t)arg);
+
+	switch (s->size) {
+	case TRACE_LONG:
+		return snprintf(buf, size, spec, (unsigned long)arg);
+	case TRACE_LLONG:
+		return snprintf(buf, size, spec, (unsigned long long)arg);
+	case TRACE_SIZE:
+		return snprintf(buf, size, spec, (size_t)arg);
+	case TRACE_PTRDIFF:
+		return snprintf(buf, size, spec, (ptrdiff_t)arg);
+	case TRACE_INTMAX:
+		return snprintf(buf, size, spec, (uintmax_t)arg);
+	default:
+		return snprintf(buf, size, spec, (unsigned int)arg);
+	}
+}
+
+/* the message as vsnprintf() would have formatted it when traced */
+static void trace_format(const struct trace_entry *e, char *buf, size_t size)
+{
+	const char *p = e->fmt;
+	struct trace_spec s;
+	char spec[16];
+	unsigned int n = 0;
+	size_t len = 0;
+	int ret;
+
+	while (*p && len < size - 1) {
+		if (*p != '%') {
+			buf[len++] = *p++;
+			continue;
+		}
+
+		trace_spec(p, &s);
+		if (s.conv == '%') {
+			buf[len++] = '%';
+			p += s.len;
+			continue;
+		}
+
+		/* the rest as is, where tracing stopped storing arguments */
+		if (n == TRACE_ARGS || s.star || !s.conv || s.len >= sizeof(spec)) {
+			snprintf(buf + len, size - len, "%s", p);
+			return;
+		}
+
+		memcpy(spec, p, s.len);
+		spec[s.len] = '\0';
+		ret = trace_conv(buf + len, size - len, spec, &s, e, e->arg[n++]);
+		if (ret > 0)
+			len += (size_t)ret < size - len ? (size_t)ret : size - len - 1;
+		p += s.len;
+	}
+
+	buf[len] = '\0';
+}
+
+void trace_dump(void)
+{
+	uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+	uint32_t idx = head > trace_entries ? head - trace_entries : 0;
+	struct trace_entry copy;
+	struct trace_entry *e;
+	char msg[TRACE_MSG];
+
+	LOG("trace: %u entries, %u dropped\n", head - idx, idx);
+
+	for (; idx != head; idx++) {
+		e = &trace_ring[idx % trace_entries];
+		if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != idx + 1)
+			continue;
+
+		memcpy(&copy, e, sizeof(copy));
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != idx + 1)
+			continue;
+
+		trace_format(&copy, msg, sizeof(msg));
+
+		/* messages carry their own newline */
+		LOG("trace: %llu.%09llu [%u] %s",
+		    (unsigned long long)(copy.ts / 1000000000ULL),
+		    (unsigned long long)(copy.ts % 1000000000ULL), copy.level, msg);
+	}
+}
+
+#endif
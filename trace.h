@@ -0,0 +1,28 @@
+/*
+ * In-memory trace ring for debug messages, debug builds only.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#ifdef URNGD_DEBUG
+
+#include <stdbool.h>
+
+#define TRACE_ENTRIES 256
+#define TRACE_ARGS 6
+#define TRACE_STR 48
+#define TRACE_MSG 160
+
+extern bool trace_enabled;
+
+void trace_init(unsigned int entries);
+void trace_printf(unsigned int level, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void trace_dump(void);
+
+#endif
+
+#endif
@@ -39,35 +39,141 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
 #include <unistd.h>
 
-#include <sys/ioctl.h>
 #include <linux/random.h>
 
 #include <libubox/uloop.h>
 
 #include "log.h"
+#include "arena.h"
+#include "boottime.h"
+#include "cache.h"
+#include "fips.h"
+#include "metrics.h"
+#include "noise.h"
+#include "phase.h"
+#include "probes.h"
+#include "ratelimit.h"
+#include "rawdump.h"
+#include "seed.h"
+#include "sink.h"
+#include "stats.h"
+#include "statspage.h"
+#include "workers.h"
 #include "jitterentropy.h"
 
 #define ENTROPYBYTES 32
 #define ENTROPYTHRESH 1024
 #define OVERSAMPLINGFACTOR 2
+#define JENT_OSR 1
+#define CREDIT_MARGIN 50
+#define RECOVER_MIN_MS 1000
+#define RECOVER_MAX_MS (5 * 60 * 1000)
+#define INJECT_BACKOFF_MIN_MS 1000
+#define INJECT_BACKOFF_MAX_MS (60 * 1000)
+#define UNCREDITED_MS 1000
+#define PROVISIONAL_MS 100
+#define BOOT_TICK_MS 1000
+#define BOOT_STABLE 10
 #define DEV_RANDOM "/dev/random"
 #define ENTROPYAVAIL "/proc/sys/kernel/random/entropy_avail"
-#define ENTROPYPOOLBYTES (sizeof(struct rand_pool_info) + \
-		(ENTROPYBYTES * OVERSAMPLINGFACTOR * sizeof(char)))
+#define ENTROPYBUFBYTES (ENTROPYBYTES * OVERSAMPLINGFACTOR * sizeof(char))
+#define ENTROPYPOOLBYTES (sizeof(struct rand_pool_info) + ENTROPYBUFBYTES)
 
 #ifdef URNGD_DEBUG
 unsigned int debug;
 #endif
 
+enum urngd_mode {
+	MODE_BOOT,
+	MODE_STEADY,
+};
+
+static const char * const mode_names[] = {
+	[MODE_BOOT] = "boot",
+	[MODE_STEADY] = "steady",
+};
+
 struct urngd {
 	struct uloop_fd rnd_fd;
+	struct sink sink;
+	unsigned int sim_drain;
+	unsigned int pool_level;
+	struct uloop_timeout stop;
 	struct rand_data *ec;
+	/* cache sized memory access buffer replacing the collector's own */
+	unsigned int memblocks;
+	unsigned int memblocksize;
+	unsigned char *jent_mem;
+#ifndef URNGD_STATIC_ALLOC
+	struct cache_info cache;
+#endif
 	struct rand_pool_info *rpi;
+	char *buf;
+	const char *calib_store;
+	unsigned int margin;
+	unsigned int credit;
+	unsigned int fips_interval;
+	unsigned int blocks;
+	bool fips_paused;
+	struct fips fips;
+	struct uloop_timeout recover;
+	unsigned int recover_delay;
+	unsigned int recover_attempts;
+	uint64_t quarantined;
+	struct uloop_timeout inject_retry;
+	unsigned int inject_failures;
+	uint64_t wakeup;
+	struct stats stats;
+	const char *statspage;
+	const char *metrics;
+	int avail_fd;
+#ifdef URNGD_DEBUG
+	struct uloop_timeout phase_dump;
+	unsigned int phase_interval;
+#endif
+	struct uloop_fd sig_fd;
+	int sig_wr;
+	/* self-test in the background, provisional injection meanwhile */
+	bool early;
+	bool failed;
+	pthread_t selftest;
+	int selftest_ret;
+	struct uloop_fd selftest_fd;
+	int selftest_wr;
+	uint64_t selftest_start;
+	struct uloop_timeout provisional;
+	unsigned int provisional_count;
+	/* all CPUs and forced reseeds after boot, until the pool is stable */
+	enum urngd_mode mode;
+	unsigned int boot_max;
+	unsigned int boot_stable;
+	/* pool level the boot phase waits for, at most what the kernel reports */
+	unsigned int boot_level;
+	uint64_t stable_since;
+	struct uloop_timeout boot_tick;
+	struct workers_stats workers;
+	/* counters and clocks when the current mode was entered */
+	struct stats mode_stats;
+	uint64_t mode_start;
+	uint64_t mode_cpu;
+	/* force a CRNG reseed after this many credited bits, 0 never */
+	unsigned int reseed_bits;
+	uint64_t reseed_credited;
 };
 
-static struct urngd urngd_service;
+static struct urngd urngd_service = {
+	.mode = MODE_STEADY,
+	.boot_stable = BOOT_STABLE,
+	.margin = CREDIT_MARGIN,
+	.credit = NOISE_CREDIT_DEFAULT,
+	.fips_interval = 1,
+	.statspage = STATSPAGE_PATH,
+	.avail_fd = -1,
+};
 
 static inline void memset_secure(void *s, int c, size_t n)
 {
@@ -75,24 +181,278 @@ static inline void memset_secure(void *s, int c, size_t n)
 	__asm__ __volatile__("" : : "r" (s) : "memory");
 }
 
+static uint64_t now_ms(void)
+{
+	return stats_now_ns() / 1000000;
+}
+
+static void stats_publish(struct urngd *u)
+{
+	statspage_update(&u->stats);
+	metrics_update();
+}
+
+static void entropy_level_sample(struct urngd *u)
+{
+	char buf[16];
+	ssize_t len;
+
+	if (u->avail_fd < 0)
+		return;
+
+	len = pread(u->avail_fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return;
+
+	buf[len] = '\0';
+	u->stats.entropy_avail = strtoull(buf, NULL, 10);
+	stats_hist_add(&u->stats.entropy_level, u->stats.entropy_avail);
+}
+
+#ifndef URNGD_STATIC_ALLOC
+/* memory access buffer geometry after the caches, checked by collector_size_check() */
+static void collector_size_init(struct urngd *u)
+{
+	unsigned int blocks, blocksize;
+
+	if (!cache_detect(&u->cache) ||
+	    !cache_mem_geometry(&u->cache, &blocks, &blocksize))
+		return;
+
+	u->memblocks = blocks;
+	u->memblocksize = blocksize;
+}
+#endif
+
+static void collector_resize(struct urngd *u)
+{
+	unsigned char *mem;
+
+	if (!u->memblocks || !u->ec->mem)
+		return;
+
+	mem = arena_alloc(u->memblocks * u->memblocksize);
+	if (!mem) {
+		ERROR("memory access buffer alloc failed\n");
+		return;
+	}
+
+	u->jent_mem = u->ec->mem;
+	u->ec->mem = mem;
+	u->ec->memblocks = u->memblocks;
+	u->ec->memblocksize = u->memblocksize;
+	u->ec->memlocation = 0;
+}
+
+static bool collector_alloc(struct urngd *u)
+{
+	u->ec = jent_entropy_collector_alloc(JENT_OSR, 0);
+	if (!u->ec) {
+		ERROR("jent-rng alloc failed\n");
+		return false;
+	}
+
+	PROBE1(collector_alloc, u->ec);
+	collector_resize(u);
+
+	return true;
+}
+
+static bool collector_init(struct urngd *u)
+{
+	int ret = jent_entropy_init();
+
+	PROBE1(collector_init, ret);
+	boottime_selftest();
+	if (ret) {
+		ERROR("jent-rng init failed, err: %d\n", ret);
+		return false;
+	}
+
+	return collector_alloc(u);
+}
+
+/* back to the collector's own memory access buffer */
+static void collector_restore(struct urngd *u)
+{
+	if (!u->jent_mem)
+		return;
+
+	arena_free(u->ec->mem);
+	u->ec->mem = u->jent_mem;
+	u->ec->memblocks = JENT_MEMORY_BLOCKS;
+	u->ec->memblocksize = JENT_MEMORY_BLOCKSIZE;
+	u->ec->memlocation = 0;
+	u->jent_mem = NULL;
+}
+
+static void collector_free(struct urngd *u)
+{
+	if (u->ec) {
+		PROBE1(collector_free, u->ec);
+		collector_restore(u);
+		jent_entropy_collector_free(u->ec);
+		u->ec = NULL;
+	}
+}
+
+#ifndef URNGD_STATIC_ALLOC
+/*
+ * Measure the collector with its own and with the cache sized buffer and
+ * tell what it does. A bigger buffer that measures worse is not worth its
+ * memory, the default one is kept then.
+ */
+static void collector_size_check(struct urngd *u)
+{
+	double h0, c0, h, c;
+
+	if (!u->memblocks)
+		return;
+
+	collector_restore(u);
+	if (!noise_quality(u->ec, &h0, &c0))
+		goto keep;
+
+	collector_resize(u);
+	if (!u->jent_mem || !noise_quality(u->ec, &h, &c))
+		goto keep;
+
+	LOG("memory access buffer %ub -> %ub (L1d %uK, last level %uK): "
+	    "%.2f -> %.2f bits/sample, %.0f -> %.0f ticks/sample\n",
+	    JENT_MEMORY_SIZE, u->memblocks * u->memblocksize,
+	    u->cache.l1d / 1024, u->cache.llc / 1024, h0, h, c0, c);
+
+	if (h >= h0)
+		return;
+
+	LOG("keeping the default memory access buffer\n");
+keep:
+	collector_restore(u);
+	u->memblocks = 0;
+	u->memblocksize = 0;
+}
+#endif
+
+/*
+ * Once the collector passed its self-test, size its buffer and derive the
+ * crediting from its own measurements, on an otherwise idle CPU.
+ */
+static void collector_calibrate(struct urngd *u)
+{
+#ifndef URNGD_STATIC_ALLOC
+	collector_size_check(u);
+#endif
+
+	u->credit = noise_credit_rate(u->ec, u->calib_store, JENT_OSR, u->margin);
+	if (!u->credit)
+		ERROR("no entropy can be credited, injecting uncredited every %ums\n",
+		      UNCREDITED_MS);
+}
+
+/*
+ * Take the collector out of service after a read failure: stop listening
+ * for low entropy and re-initialize it from scratch with exponential backoff.
+ */
+static void collector_quarantine(struct urngd *u)
+{
+	if (u->recover.pending)
+		return;
+
+	uloop_fd_delete(&u->rnd_fd);
+	collector_free(u);
+
+	u->quarantined = now_ms();
+	u->recover_attempts = 0;
+	u->recover_delay = RECOVER_MIN_MS;
+	uloop_timeout_set(&u->recover, u->recover_delay);
+
+	ERROR("collector quarantined, re-initializing in %ums\n",
+	      u->recover_delay);
+}
+
+/* bytes of jitter output needed to credit ENTROPYBYTES of entropy */
+static size_t inject_len(struct urngd *u)
+{
+	size_t max = ENTROPYBYTES * OVERSAMPLINGFACTOR;
+	size_t len;
+
+	if (!u->credit)
+		return max;
+
+	len = (ENTROPYBYTES * 1000 + u->credit - 1) / u->credit;
+
+	return len < max ? len : max;
+}
+
+static void urngd_reseed(struct urngd *u)
+{
+	if (sink_reseed(&u->sink) < 0) {
+		/*
+		 * not ready yet, the kernel does the first seeding itself, or
+		 * a simulated pool, which has no CRNG to reseed
+		 */
+		if (errno == ENODATA || errno == EOPNOTSUPP) {
+			u->reseed_credited = 0;
+			return;
+		}
+
+		ratelimit_error(RL_RESEED, errno, "error reseeding: %s\n",
+				strerror(errno));
+		return;
+	}
+
+	u->stats.reseeds++;
+	u->reseed_credited = 0;
+	boottime_reseeded();
+}
+
+/* bookkeeping for entropy that made it into the kernel, 0 if uncredited */
+static void entropy_credited(struct urngd *u, size_t bits)
+{
+	boottime_injected(bits);
+	if (!bits)
+		return;
+
+	seed_credited(bits);
+
+	u->reseed_credited += bits;
+	if (u->reseed_bits && u->reseed_credited >= u->reseed_bits)
+		urngd_reseed(u);
+}
+
 static size_t write_entropy(struct urngd *u, char *buf, size_t len,
-			    size_t entropy_bytes)
+			    size_t entropy_bits)
 {
 	int ret;
 	size_t written = 0;
+	uint64_t start;
 
-	/* value is in bits */
-	u->rpi->entropy_count = (entropy_bytes * 8);
+	u->rpi->entropy_count = entropy_bits;
 	u->rpi->buf_size = len;
 	memcpy(u->rpi->buf, buf, len);
 	memset(buf, 0, len);
 
-	ret =  ioctl(u->rnd_fd.fd, RNDADDENTROPY, u->rpi);
+	PROBE2(write_entropy, len, entropy_bits);
+	start = stats_now_ns();
+	ret = sink_inject(&u->sink, u->rpi);
+	stats_hist_add(&u->stats.ioctl, stats_now_ns() - start);
+	PROBE2(write_entropy_done, ret, entropy_bits);
 	if (0 > ret) {
-		ERROR("error injecting entropy: %s\n", strerror(errno));
+		ratelimit_error(RL_IOCTL, errno, "error injecting entropy: %s\n",
+				strerror(errno));
+		u->stats.ioctl_failures++;
 	} else {
-		DEBUG(1, "injected %zub (%zub of entropy)\n", len, entropy_bytes);
+		DEBUG(1, "injected %zub (%zu bits of entropy)\n", len, entropy_bits);
 		written = len;
+		u->stats.injected_bytes += len;
+		u->stats.credited_bits += entropy_bits;
+		entropy_credited(u, entropy_bits);
+
+		if (u->wakeup && entropy_bits) {
+			stats_hist_add(&u->stats.wakeup_credit,
+				       stats_now_ns() - u->wakeup);
+			u->wakeup = 0;
+		}
 	}
 
 	u->rpi->entropy_count = 0;
@@ -102,26 +462,115 @@ static size_t write_entropy(struct urngd *u, char *buf, size_t len,
 	return written;
 }
 
+/*
+ * Stop reacting to low entropy wakeups for a while after a failed injection,
+ * doubling the pause with every consecutive failure.
+ */
+static void inject_backoff(struct urngd *u)
+{
+	unsigned int delay = INJECT_BACKOFF_MIN_MS;
+	unsigned int i;
+
+	for (i = 0; i < u->inject_failures && delay < INJECT_BACKOFF_MAX_MS; i++)
+		delay *= 2;
+	if (delay > INJECT_BACKOFF_MAX_MS)
+		delay = INJECT_BACKOFF_MAX_MS;
+
+	u->inject_failures++;
+	uloop_fd_delete(&u->rnd_fd);
+	uloop_timeout_set(&u->inject_retry, delay);
+	DEBUG(1, "injection failed %u times, retrying in %ums\n",
+	      u->inject_failures, delay);
+}
+
+/* returns false if the block has to be discarded */
+static bool fips_check(struct urngd *u, const char *buf, size_t len)
+{
+	enum fips_result ret;
+
+	if (!u->fips_interval || (u->blocks++ % u->fips_interval))
+		return true;
+
+	PHASE_START(start);
+	ret = fips_update(&u->fips, buf, len);
+	PHASE_END(PHASE_SELFTEST, start);
+
+	switch (ret) {
+	case FIPS_FAIL:
+		if (!u->fips_paused)
+			ERROR("FIPS 140-2 self-test failed (0x%x), crediting paused\n",
+			      u->fips.failed);
+		u->fips_paused = true;
+		u->stats.fips_failures++;
+		return false;
+	case FIPS_PASS:
+		if (u->fips_paused)
+			LOG("FIPS 140-2 self-test passed, crediting resumed\n");
+		u->fips_paused = false;
+		break;
+	case FIPS_PENDING:
+		break;
+	}
+
+	return true;
+}
+
 static size_t gather_entropy(struct urngd *u)
 {
 	size_t ret = 0;
-	char buf[(ENTROPYBYTES * OVERSAMPLINGFACTOR)];
+	size_t len = inject_len(u);
+	size_t bits = len * 8 * u->credit / 1000;
+	char *buf = u->buf;
+	uint64_t start;
+	ssize_t err;
 
-	if (jent_read_entropy(u->ec, buf, sizeof(buf)) < 0) {
-		ERROR("cannot read entropy\n");
+	if (!u->ec)
+		return 0;
+
+	PROBE2(gather_entropy, len, bits);
+	start = stats_now_ns();
+	PHASE_WATCH(u->ec);
+	err = jent_read_entropy(u->ec, buf, len);
+	PHASE_WATCH(NULL);
+	stats_hist_add(&u->stats.collect, stats_now_ns() - start);
+	PROBE1(gather_entropy_collected, err);
+	if (err < 0) {
+		ratelimit_error(RL_READ, 0, "cannot read entropy\n");
+		u->stats.read_failures++;
+		collector_quarantine(u);
 		return 0;
 	}
 
-	ret = write_entropy(u, buf, sizeof(buf), ENTROPYBYTES);
-	if (sizeof(buf) != ret) {
-		ERROR("injected %zub of entropy, less then %zub expected\n",
-		      ret, sizeof(buf));
+	if (!fips_check(u, buf, len)) {
+		memset_secure(buf, 0, ENTROPYBUFBYTES);
+		return 0;
+	}
+
+	if (u->fips_paused)
+		bits = 0;
+
+	ret = write_entropy(u, buf, len, bits);
+	if (len != ret) {
+		ratelimit_error(RL_SHORT, 0,
+				"injected %zub of entropy, less then %zub expected\n",
+				ret, len);
+		inject_backoff(u);
 	} else {
-		ret = sizeof(buf);
+		u->inject_failures = 0;
 	}
 
-	memset_secure(buf, 0, sizeof(buf));
+	/*
+	 * Uncredited input does not raise the pool, which would wake us up
+	 * again right away, so fall back to a timer until crediting resumes.
+	 */
+	if (!bits && ret && !u->inject_retry.pending) {
+		uloop_fd_delete(&u->rnd_fd);
+		uloop_timeout_set(&u->inject_retry, UNCREDITED_MS);
+	}
+
+	memset_secure(buf, 0, ENTROPYBUFBYTES);
 	DEBUG(2, DEV_RANDOM " fed with %zub of entropy\n", ret);
+	PROBE2(gather_entropy_done, ret, bits);
 
 	return ret;
 }
@@ -131,69 +580,536 @@ static void low_entropy_cb(struct uloop_fd *ufd, unsigned int events)
 	struct urngd *u = container_of(ufd, struct urngd, rnd_fd);
 
 	DEBUG(2, DEV_RANDOM " signals low entropy\n");
+	sink_ack(&u->sink);
+	u->stats.wakeups++;
+	u->wakeup = stats_now_ns();
+	entropy_level_sample(u);
+	PROBE1(low_entropy, u->stats.entropy_avail);
+	gather_entropy(u);
+	stats_publish(u);
+}
+
+static void urngd_signal(int sig)
+{
+	char c = sig;
+
+	if (write(urngd_service.sig_wr, &c, 1) < 0)
+		return;
+}
+
+static void signal_cb(struct uloop_fd *ufd, unsigned int events)
+{
+	struct urngd *u = container_of(ufd, struct urngd, sig_fd);
+	char c[8];
+
+	while (read(ufd->fd, c, sizeof(c)) > 0)
+		;
+
+	stats_dump(&u->stats);
+#ifdef URNGD_DEBUG
+	phase_dump(&u->stats);
+	if (trace_enabled)
+		trace_dump();
+#endif
+}
+
+#ifdef URNGD_DEBUG
+static void phase_dump_cb(struct uloop_timeout *t)
+{
+	struct urngd *u = container_of(t, struct urngd, phase_dump);
+
+	phase_dump(&u->stats);
+	uloop_timeout_set(t, u->phase_interval * 1000);
+}
+#endif
+
+/* SIGUSR1 dumps the runtime statistics, handled from within the uloop */
+static bool signal_init(struct urngd *u)
+{
+	struct sigaction sa = { .sa_handler = urngd_signal };
+	int fds[2];
+
+	if (pipe(fds)) {
+		ERROR("signal pipe failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	u->sig_wr = fds[1];
+	u->sig_fd.fd = fds[0];
+	u->sig_fd.cb = signal_cb;
+	uloop_fd_add(&u->sig_fd, ULOOP_READ);
+
+	sigaction(SIGUSR1, &sa, NULL);
+
+	return true;
+}
+
+static void inject_retry_cb(struct uloop_timeout *t)
+{
+	struct urngd *u = container_of(t, struct urngd, inject_retry);
+
+	/* re-armed by the collector recovery instead */
+	if (!u->ec)
+		return;
+
+	uloop_fd_add(&u->rnd_fd, ULOOP_READ);
 	gather_entropy(u);
+	stats_publish(u);
+}
+
+static void collector_recover_cb(struct uloop_timeout *t)
+{
+	struct urngd *u = container_of(t, struct urngd, recover);
+
+	u->recover_attempts++;
+	if (!collector_init(u)) {
+		collector_free(u);
+		u->recover_delay *= 2;
+		if (u->recover_delay > RECOVER_MAX_MS)
+			u->recover_delay = RECOVER_MAX_MS;
+
+		ERROR("collector re-initialization failed, retrying in %ums\n",
+		      u->recover_delay);
+		uloop_timeout_set(t, u->recover_delay);
+		return;
+	}
+
+	u->stats.recoveries++;
+	uloop_timeout_cancel(&u->inject_retry);
+	LOG("collector recovered after %u attempts in %llums, %u recoveries so far\n",
+	    u->recover_attempts, (unsigned long long)(now_ms() - u->quarantined),
+	    (unsigned int)u->stats.recoveries);
+
+	uloop_fd_add(&u->rnd_fd, ULOOP_READ);
+	gather_entropy(u);
+	stats_publish(u);
+}
+
+static uint64_t cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void mode_enter(struct urngd *u, enum urngd_mode mode)
+{
+	u->mode = mode;
+	u->mode_stats = u->stats;
+	u->mode_start = now_ms();
+	u->mode_cpu = cpu_ns();
+}
+
+static void mode_report(struct urngd *u)
+{
+	const struct stats *s = &u->stats, *m = &u->mode_stats;
+
+	LOG("%s phase: %.1fs, cpu %.1fs, %llu wakeups, injected %lluB, "
+	    "credited %llu bits, %llu reseeds\n", mode_names[u->mode],
+	    (now_ms() - u->mode_start) / 1e3, (cpu_ns() - u->mode_cpu) / 1e9,
+	    (unsigned long long)(s->wakeups - m->wakeups),
+	    (unsigned long long)(s->injected_bytes - m->injected_bytes),
+	    (unsigned long long)(s->credited_bits - m->credited_bits),
+	    (unsigned long long)(s->reseeds - m->reseeds));
+}
+
+/* fold what the boot workers did since the last call into the stats */
+static void workers_merge(struct urngd *u)
+{
+	struct workers_stats ws, *last = &u->workers;
+	uint64_t bits;
+
+	workers_collect(&ws);
+
+	bits = ws.credited_bits - last->credited_bits;
+	u->stats.injected_bytes += ws.injected_bytes - last->injected_bytes;
+	u->stats.credited_bits += bits;
+	u->stats.ioctl_failures += ws.ioctl_failures - last->ioctl_failures;
+	u->stats.read_failures += ws.read_failures - last->read_failures;
+	u->stats.fips_failures += ws.fips_failures - last->fips_failures;
+	*last = ws;
+
+	if (bits)
+		entropy_credited(u, bits);
+}
+
+static void boot_end(struct urngd *u)
+{
+	uloop_timeout_cancel(&u->boot_tick);
+	workers_merge(u);
+	workers_stop();
+	mode_report(u);
+	mode_enter(u, MODE_STEADY);
+	stats_publish(u);
+}
+
+static void boot_tick_cb(struct uloop_timeout *t)
+{
+	struct urngd *u = container_of(t, struct urngd, boot_tick);
+	uint64_t now = now_ms();
+	bool ready;
+
+	workers_merge(u);
+	gather_entropy(u);
+
+	/* the kernel refuses to reseed a CRNG that is not ready yet */
+	ready = boottime_crng_ready();
+	if (ready)
+		urngd_reseed(u);
+
+	entropy_level_sample(u);
+	stats_publish(u);
+
+	if (ready && u->stats.entropy_avail >= u->boot_level) {
+		if (!u->stable_since)
+			u->stable_since = now;
+	} else {
+		u->stable_since = 0;
+	}
+
+	if ((u->stable_since && now - u->stable_since >= u->boot_stable * 1000ULL) ||
+	    now - u->mode_start >= u->boot_max * 1000ULL) {
+		LOG("boot phase over, %s\n", u->stable_since ?
+		    "CRNG ready and pool stable" : "time limit reached");
+		boot_end(u);
+		return;
+	}
+
+	uloop_timeout_set(t, BOOT_TICK_MS);
+}
+
+static void boot_start(struct urngd *u)
+{
+	unsigned int n, size;
+
+	if (!u->boot_max) {
+		mode_enter(u, MODE_STEADY);
+		return;
+	}
+
+	size = boottime_pool_size();
+	u->boot_level = size && size < u->pool_level ? size : u->pool_level;
+
+	mode_enter(u, MODE_BOOT);
+	n = workers_start(&u->sink, JENT_OSR, u->credit, u->fips_interval,
+			  u->memblocks, u->memblocksize);
+	LOG("boot phase: %u workers, up to %us, pool level %u\n", n,
+	    u->boot_max, u->boot_level);
+
+	u->boot_tick.cb = boot_tick_cb;
+	boot_tick_cb(&u->boot_tick);
+}
+
+/* uncredited collector-style output while the self-test is still running */
+static void provisional_cb(struct uloop_timeout *t)
+{
+	struct urngd *u = container_of(t, struct urngd, provisional);
+
+	if (noise_read(u->buf, ENTROPYBUFBYTES, JENT_OSR) < 0) {
+		ratelimit_error(RL_READ, 0, "cannot read provisional entropy\n");
+	} else if (write_entropy(u, u->buf, ENTROPYBUFBYTES, 0)) {
+		u->provisional_count++;
+		stats_publish(u);
+	}
+
+	memset_secure(u->buf, 0, ENTROPYBUFBYTES);
+	uloop_timeout_set(t, PROVISIONAL_MS);
+}
+
+static void *selftest_thread(void *arg)
+{
+	struct urngd *u = arg;
+	char c = 0;
+
+	u->selftest_ret = jent_entropy_init();
+	if (write(u->selftest_wr, &c, 1) < 0)
+		ERROR("self-test wakeup failed: %s\n", strerror(errno));
+
+	return NULL;
+}
+
+static void selftest_join(struct urngd *u)
+{
+	if (!u->selftest_fd.fd)
+		return;
+
+	pthread_join(u->selftest, NULL);
+	uloop_fd_delete(&u->selftest_fd);
+	close(u->selftest_fd.fd);
+	close(u->selftest_wr);
+	u->selftest_fd.fd = 0;
+}
+
+static void selftest_done_cb(struct uloop_fd *ufd, unsigned int events)
+{
+	struct urngd *u = container_of(ufd, struct urngd, selftest_fd);
+
+	selftest_join(u);
+	uloop_timeout_cancel(&u->provisional);
+
+	PROBE1(collector_init, u->selftest_ret);
+	boottime_selftest();
+	if (u->selftest_ret) {
+		ERROR("jent-rng init failed, err: %d\n", u->selftest_ret);
+		u->failed = true;
+		uloop_end();
+		return;
+	}
+
+	if (!collector_alloc(u)) {
+		u->failed = true;
+		uloop_end();
+		return;
+	}
+
+	collector_calibrate(u);
+
+	LOG("self-test passed after %llums, %u provisional injections before\n",
+	    (unsigned long long)(now_ms() - u->selftest_start),
+	    u->provisional_count);
+
+	uloop_fd_add(&u->rnd_fd, ULOOP_READ);
+	gather_entropy(u);
+	stats_publish(u);
+	boot_start(u);
+}
+
+static bool selftest_start(struct urngd *u)
+{
+	int fds[2];
+
+	if (pipe(fds)) {
+		ERROR("self-test pipe failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	u->selftest_wr = fds[1];
+	u->selftest_fd.fd = fds[0];
+	u->selftest_fd.cb = selftest_done_cb;
+	u->selftest_start = now_ms();
+
+	if (pthread_create(&u->selftest, NULL, selftest_thread, u)) {
+		ERROR("self-test thread failed\n");
+		close(fds[0]);
+		close(fds[1]);
+		u->selftest_fd.fd = 0;
+		return false;
+	}
+
+	uloop_fd_add(&u->selftest_fd, ULOOP_READ);
+
+	return true;
 }
 
 static void urngd_done(struct urngd *u)
 {
-	if (u->ec) {
-		jent_entropy_collector_free(u->ec);
-		u->ec = NULL;
+	uloop_timeout_cancel(&u->recover);
+	uloop_timeout_cancel(&u->inject_retry);
+	uloop_timeout_cancel(&u->provisional);
+	selftest_join(u);
+	if (u->mode == MODE_BOOT) {
+		uloop_timeout_cancel(&u->boot_tick);
+		workers_merge(u);
+		workers_stop();
 	}
+	if (u->mode_start)
+		mode_report(u);
+	ratelimit_flush();
+	boottime_done();
+#ifdef URNGD_DEBUG
+	uloop_timeout_cancel(&u->phase_dump);
+#endif
+	collector_free(u);
+
+	statspage_close();
+	metrics_done();
+
+	if (u->avail_fd >= 0) {
+		close(u->avail_fd);
+		u->avail_fd = -1;
+	}
+
+	if (u->sig_fd.fd) {
+		uloop_fd_delete(&u->sig_fd);
+		close(u->sig_fd.fd);
+		close(u->sig_wr);
+		u->sig_fd.fd = 0;
+	}
+
+	seed_done();
+
+	arena_free(u->rpi);
+	u->rpi = NULL;
+	arena_free(u->buf);
+	u->buf = NULL;
+
+	uloop_timeout_cancel(&u->stop);
+	sink_close(&u->sink);
+	u->rnd_fd.fd = 0;
+}
 
-	if (u->rpi) {
-		memset(u->rpi, 0, ENTROPYPOOLBYTES);
-		free(u->rpi);
-		u->rpi = NULL;
+static void stop_cb(struct uloop_timeout *t)
+{
+	uloop_end();
+}
+
+/*
+ * Make room in the arena for the collector and the boot workers' ones,
+ * with the cache sized buffer, before anything is allocated. Whether it's
+ * used is only known once the collector passed its self-test.
+ */
+static void urngd_reserve(struct urngd *u)
+{
+	size_t len = ARENA_COLLECTOR;
+	unsigned int slots = 2;
+
+	if (u->memblocks) {
+		len += ARENA_ROUND(u->memblocks * u->memblocksize);
+		slots++;
 	}
 
-	if (u->rnd_fd.fd) {
-		close(u->rnd_fd.fd);
-		u->rnd_fd.fd = 0;
+	arena_reserve(len, slots);
+	if (u->boot_max)
+		workers_reserve(u->memblocks * u->memblocksize);
+}
+
+/* raw dumps describe the collector as deployed, a fresh one for every run */
+static struct rand_data *rawdump_collector(void)
+{
+	struct urngd *u = &urngd_service;
+
+	collector_free(u);
+
+	return collector_alloc(u) ? u->ec : NULL;
+}
+
+static int urngd_rawdump(struct urngd *u, const char *path, size_t samples,
+			 bool restarts)
+{
+	bool ok = false;
+
+	if (collector_init(u)) {
+#ifndef URNGD_STATIC_ALLOC
+		collector_size_check(u);
+#endif
+		ok = rawdump_run(path, samples, restarts, rawdump_collector);
 	}
+
+	collector_free(u);
+	arena_done();
+
+	return ok ? 0 : -1;
+}
+
+/* opened early, the seed goes in before anything else */
+static bool urngd_sink_open(struct urngd *u)
+{
+	if (u->sim_drain)
+		return sink_sim_open(&u->sink, u->sim_drain, u->pool_level);
+
+	return sink_kernel_open(&u->sink);
 }
 
 static bool urngd_init(struct urngd *u)
 {
-	int ret = jent_entropy_init();
-	if (ret) {
-		ERROR("jent-rng init failed, err: %d\n", ret);
+	if (u->early && !selftest_start(u))
 		return false;
+
+	if (!u->early) {
+		if (!collector_init(u))
+			return false;
+		collector_calibrate(u);
 	}
 
-	u->ec = jent_entropy_collector_alloc(1, 0);
-	if (!u->ec) {
-		ERROR("jent-rng alloc failed\n");
+	u->recover.cb = collector_recover_cb;
+	u->inject_retry.cb = inject_retry_cb;
+
+	if (!signal_init(u))
 		return false;
-	}
 
-	u->rpi = malloc(ENTROPYPOOLBYTES);
-	if (!u->rpi) {
+	if (u->statspage && *u->statspage)
+		statspage_open(u->statspage);
+
+	if (u->metrics)
+		metrics_init(u->metrics, &u->stats);
+
+	u->avail_fd = open(ENTROPYAVAIL, O_RDONLY | O_CLOEXEC);
+
+#ifdef URNGD_DEBUG
+	u->phase_dump.cb = phase_dump_cb;
+	if (u->phase_interval)
+		uloop_timeout_set(&u->phase_dump, u->phase_interval * 1000);
+#endif
+
+	fips_reset(&u->fips);
+
+	u->rpi = arena_alloc(ENTROPYPOOLBYTES);
+	u->buf = arena_alloc(ENTROPYBUFBYTES);
+	if (!u->rpi || !u->buf) {
 		ERROR("rand pool alloc failed\n");
 		return false;
 	}
 
 	u->rnd_fd.cb = low_entropy_cb;
-	u->rnd_fd.fd = open(DEV_RANDOM, O_WRONLY);
-	if (u->rnd_fd.fd < 1) {
-		ERROR(DEV_RANDOM " open failed: %s\n", strerror(errno));
-		return false;
+	u->rnd_fd.fd = u->sink.fd;
+
+	if (u->early) {
+		u->provisional.cb = provisional_cb;
+		provisional_cb(&u->provisional);
+	} else {
+		uloop_fd_add(&u->rnd_fd, ULOOP_READ);
+		boot_start(u);
 	}
 
-	uloop_fd_add(&u->rnd_fd, ULOOP_READ);
+	arena_report();
 
 	return true;
 }
 
 static int usage(const char *prog)
 {
+#ifdef URNGD_NO_USAGE
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+#else
 	fprintf(stderr, "Usage: %s [options]\n"
 		"Options:\n"
+		"	-b <file>	Measure boot-time readiness, append the report to <file> if not empty\n"
+		"	-B <seconds>	Boot phase on all CPUs with forced reseeds for up to <seconds> (default 0, off)\n"
 #ifdef URNGD_DEBUG
 		"	-d <level>	Enable debug messages\n"
+		"	-i <seconds>	Log a per-phase timing breakdown periodically\n"
+		"	-t <entries>	Keep the last <entries> debug messages in a trace ring dumped on SIGUSR1\n"
 #endif
+		"	-C <file>	Keep per CPU model entropy estimates in <file>\n"
+		"	-E		Inject uncredited right away, run the self-test in the background\n"
+		"	-e <bits>	Credit up to <bits> of the seed file if only its owner can access it (default 0)\n"
+		"	-F <n>		Run FIPS 140-2 tests on every n-th block, 0 disables (default 1)\n"
+		"	-G <seconds>	Leave the boot phase once the CRNG is ready and the pool stayed above -l for <seconds> (default %d)\n"
+		"	-l <bits>	Pool level for the readiness report, the boot phase and simulated pool wakeups (default %d)\n"
+		"	-m <percent>	Safety margin taken off the estimate (default %d)\n"
+		"	-M <file>	Statistics page, empty to disable (default " STATSPAGE_PATH ")\n"
+		"	-n <count>	Number of raw samples to dump (default %d)\n"
+		"	-P <addr>	Serve Prometheus metrics on a unix socket path or [host:]port\n"
+		"	-r <file>	Dump raw time deltas to <file> and exit\n"
+		"	-R <bits>	Force a CRNG reseed after every <bits> of credited entropy\n"
+		"	-s <file>	Mix in the seed journal <file> at startup and keep it updated\n"
 		"	-S		Print messages to stdout\n"
-		"\n", prog);
+		"	-T <seconds>	Exit after <seconds>\n"
+		"	-w <seconds>	Minimum time between seed journal writes (default %d)\n"
+		"	-x		Dump %d restarts instead of a sequential run\n"
+		"	-z <bits/s>	Feed a simulated pool drained at <bits/s> instead of " DEV_RANDOM "\n"
+		"\n", prog, BOOT_STABLE, ENTROPYTHRESH, CREDIT_MARGIN, RAWDUMP_SAMPLES,
+		SEED_INTERVAL, RAWDUMP_RESTARTS);
+#endif
 	return 1;
 }
 
@@ -201,6 +1117,16 @@ int main(int argc, char **argv)
 {
 	int ch;
 	int ulog_channels = ULOG_KMSG;
+	const char *rawdump = NULL;
+	size_t rawdump_samples = RAWDUMP_SAMPLES;
+	bool rawdump_restarts = false;
+	const char *boottime = NULL;
+	unsigned int pool_level = ENTROPYTHRESH;
+	unsigned int run_time = 0;
+	const char *seed_file = NULL;
+	unsigned int seed_credit = 0;
+	unsigned int seed_interval = SEED_INTERVAL;
+	size_t bits;
 #ifdef URNGD_DEBUG
 	char *dbglvl = getenv("DBGLVL");
 
@@ -210,16 +1136,79 @@ int main(int argc, char **argv)
 	}
 #endif
 
-	while ((ch = getopt(argc, argv, "d:S")) != -1) {
+	while ((ch = getopt(argc, argv, "b:B:C:d:e:EF:G:i:l:m:M:n:P:r:R:s:St:T:w:xz:")) != -1) {
 		switch (ch) {
+		case 'b':
+			boottime = optarg;
+			break;
+		case 'B':
+			urngd_service.boot_max = atoi(optarg);
+			break;
 #ifdef URNGD_DEBUG
 		case 'd':
 			debug = atoi(optarg);
 			break;
+		case 'i':
+			urngd_service.phase_interval = atoi(optarg);
+			break;
+		case 't':
+			trace_init(atoi(optarg));
+			break;
 #endif
+		case 'C':
+			urngd_service.calib_store = optarg;
+			break;
+		case 'e':
+			seed_credit = atoi(optarg);
+			break;
+		case 'E':
+			urngd_service.early = true;
+			break;
+		case 'F':
+			urngd_service.fips_interval = atoi(optarg);
+			break;
+		case 'G':
+			urngd_service.boot_stable = atoi(optarg);
+			break;
+		case 'l':
+			pool_level = atoi(optarg);
+			break;
+		case 'm':
+			urngd_service.margin = atoi(optarg);
+			break;
+		case 'M':
+			urngd_service.statspage = optarg;
+			break;
+		case 'n':
+			rawdump_samples = strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			urngd_service.metrics = optarg;
+			break;
+		case 'r':
+			rawdump = optarg;
+			break;
+		case 'R':
+			urngd_service.reseed_bits = atoi(optarg);
+			break;
+		case 's':
+			seed_file = optarg;
+			break;
 		case 'S':
 			ulog_channels = ULOG_STDIO;
 			break;
+		case 'T':
+			run_time = atoi(optarg);
+			break;
+		case 'w':
+			seed_interval = atoi(optarg);
+			break;
+		case 'x':
+			rawdump_restarts = true;
+			break;
+		case 'z':
+			urngd_service.sim_drain = atoi(optarg);
+			break;
 		default:
 			return usage(argv[0]);
 		}
@@ -227,18 +1216,50 @@ int main(int argc, char **argv)
 
 	ulog_open(ulog_channels, LOG_DAEMON, "urngd");
 
+#ifndef URNGD_STATIC_ALLOC
+	collector_size_init(&urngd_service);
+#endif
+
+	urngd_reserve(&urngd_service);
+
+	if (rawdump)
+		return urngd_rawdump(&urngd_service, rawdump, rawdump_samples,
+				     rawdump_restarts);
+
+	uloop_init();
+
+	if (boottime)
+		boottime_init(*boottime ? boottime : NULL, pool_level,
+			      urngd_service.reseed_bits);
+
+	urngd_service.pool_level = pool_level;
+	if (!urngd_sink_open(&urngd_service))
+		return -1;
+
+	if (seed_file) {
+		bits = seed_load(seed_file, seed_credit, seed_interval,
+				 &urngd_service.stats, &urngd_service.sink);
+		if (bits)
+			boottime_injected(bits);
+	}
+
 	if (!urngd_init(&urngd_service))
 		return -1;
 
+	urngd_service.stop.cb = stop_cb;
+	if (run_time)
+		uloop_timeout_set(&urngd_service.stop, run_time * 1000);
+
 	LOG("v%s started.\n", URNGD_VERSION);
 
 	gather_entropy(&urngd_service);
+	stats_publish(&urngd_service);
 
-	uloop_init();
 	uloop_run();
 	uloop_done();
 
 	urngd_done(&urngd_service);
+	arena_done();
 
-	return 0;
+	return urngd_service.failed ? -1 : 0;
 }
@@ -0,0 +1,290 @@
+/*
+ * Per-CPU collector threads for the boot phase.
+ *
+ * One thread per CPU the process may run on, each pinned to its CPU and
+ * running its own collector back to back, injecting straight into the sink.
+ * The FIPS 140-2 tests run on every n-th block like on the main loop's. Collectors and
+ * buffers live in the locked arena, in room reserved at startup, and are set
+ * up and freed from the main thread. Their memory access buffer has the
+ * same geometry as the main collector's, which the crediting rate was
+ * estimated on. The counters are only ever added to atomically and summed
+ * up by workers_collect().
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/random.h>
+
+#include "log.h"
+#include "arena.h"
+#include "fips.h"
+#include "sink.h"
+#include "workers.h"
+#include "jitterentropy.h"
+
+#define WORKER_BACKOFF_MS 100
+
+struct worker {
+	pthread_t thread;
+	unsigned int cpu;
+	struct rand_data *ec;
+	/* the collector's own buffer while the resized one is in use */
+	unsigned char *jent_mem;
+	struct rand_pool_info *rpi;
+	struct fips fips;
+	bool fips_paused;
+	uint64_t blocks;
+	struct workers_stats stats;
+};
+
+static struct {
+	struct sink *sink;
+	unsigned int len;
+	unsigned int bits;
+	unsigned int fips_interval;
+	unsigned int memblocks;
+	unsigned int memblocksize;
+	bool stop;
+	unsigned int n;
+	struct worker w[WORKERS_MAX];
+} workers;
+
+static void worker_count(uint64_t *counter, uint64_t n)
+{
+	__atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+static void worker_backoff(void)
+{
+	struct timespec ts = { .tv_nsec = WORKER_BACKOFF_MS * 1000000L };
+
+	nanosleep(&ts, NULL);
+}
+
+/* as fips_check() in urngd.c, returns false if the block has to be discarded */
+static bool worker_fips(struct worker *w, const void *buf)
+{
+	if (!workers.fips_interval || (w->blocks++ % workers.fips_interval))
+		return true;
+
+	switch (fips_update(&w->fips, buf, workers.len)) {
+	case FIPS_FAIL:
+		worker_count(&w->stats.fips_failures, 1);
+		w->fips_paused = true;
+		return false;
+	case FIPS_PASS:
+		w->fips_paused = false;
+		break;
+	default:
+		break;
+	}
+
+	return true;
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	struct rand_pool_info *rpi = w->rpi;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	while (!__atomic_load_n(&workers.stop, __ATOMIC_RELAXED)) {
+		if (jent_read_entropy(w->ec, (char *)rpi->buf, workers.len) < 0) {
+			worker_count(&w->stats.read_failures, 1);
+			break;
+		}
+
+		if (!worker_fips(w, rpi->buf))
+			continue;
+
+		rpi->entropy_count = w->fips_paused ? 0 : workers.bits;
+		rpi->buf_size = workers.len;
+		if (sink_inject(workers.sink, rpi) < 0) {
+			worker_count(&w->stats.ioctl_failures, 1);
+			worker_backoff();
+			continue;
+		}
+
+		worker_count(&w->stats.injected_bytes, workers.len);
+		worker_count(&w->stats.credited_bits, rpi->entropy_count);
+	}
+
+	memset(rpi->buf, 0, WORKER_BLOCK);
+	__asm__ __volatile__("" : : "r" (rpi) : "memory");
+
+	return NULL;
+}
+
+/* same memory access buffer geometry as the main collector */
+static bool worker_resize(struct worker *w)
+{
+	unsigned char *mem;
+
+	if (!workers.memblocks || !w->ec->mem)
+		return true;
+
+	mem = arena_alloc(workers.memblocks * workers.memblocksize);
+	if (!mem)
+		return false;
+
+	w->jent_mem = w->ec->mem;
+	w->ec->mem = mem;
+	w->ec->memblocks = workers.memblocks;
+	w->ec->memblocksize = workers.memblocksize;
+	w->ec->memlocation = 0;
+
+	return true;
+}
+
+static void worker_free(struct worker *w)
+{
+	if (w->jent_mem) {
+		arena_free(w->ec->mem);
+		w->ec->mem = w->jent_mem;
+		w->ec->memblocks = JENT_MEMORY_BLOCKS;
+		w->ec->memblocksize = JENT_MEMORY_BLOCKSIZE;
+		w->ec->memlocation = 0;
+	}
+	if (w->ec)
+		jent_entropy_collector_free(w->ec);
+	arena_free(w->rpi);
+	memset(w, 0, sizeof(*w));
+}
+
+/*
+ * The CPUs the process may run on, which are online, up to WORKERS_MAX.
+ * Falls back to the CPU it's running on.
+ */
+static unsigned int workers_cpus(unsigned int *cpus)
+{
+	unsigned int i, n = 0;
+	cpu_set_t set;
+	int cpu;
+
+	if (!sched_getaffinity(0, sizeof(set), &set)) {
+		for (i = 0; i < CPU_SETSIZE && n < WORKERS_MAX; i++)
+			if (CPU_ISSET(i, &set))
+				cpus[n++] = i;
+	}
+
+	if (!n) {
+		cpu = sched_getcpu();
+		cpus[n++] = cpu < 0 ? 0 : cpu;
+	}
+
+	return n;
+}
+
+/*
+ * Arena room for a collector, its resized memory access buffer of memsize
+ * bytes, if any, and a pool buffer per worker.
+ */
+void workers_reserve(size_t memsize)
+{
+	unsigned int cpus[WORKERS_MAX];
+	unsigned int ncpu = workers_cpus(cpus);
+	size_t len = WORKER_ARENA;
+	unsigned int slots = WORKER_ARENA_SLOTS;
+
+	if (memsize) {
+		len += ARENA_ROUND(memsize);
+		slots++;
+	}
+
+	arena_reserve(ncpu * len, ncpu * slots);
+}
+
+/*
+ * Returns the number of workers started. fips_interval is as -F, memblocks
+ * and memblocksize give the memory access buffer geometry, 0 for the
+ * collector's default.
+ */
+unsigned int workers_start(struct sink *sink, unsigned int osr,
+			   unsigned int credit, unsigned int fips_interval,
+			   unsigned int memblocks, unsigned int memblocksize)
+{
+	unsigned int cpus[WORKERS_MAX];
+	unsigned int i, ncpu = workers_cpus(cpus);
+	struct worker *w;
+
+	if (workers.n)
+		return workers.n;
+
+	workers.sink = sink;
+	workers.len = WORKER_BLOCK;
+	workers.bits = WORKER_BLOCK * 8 * credit / 1000;
+	workers.fips_interval = fips_interval;
+	workers.memblocks = memblocks;
+	workers.memblocksize = memblocksize;
+	workers.stop = false;
+
+	for (i = 0; i < ncpu; i++) {
+		w = &workers.w[workers.n];
+		w->cpu = cpus[i];
+		w->ec = jent_entropy_collector_alloc(osr, 0);
+		w->rpi = arena_alloc(sizeof(*w->rpi) + WORKER_BLOCK);
+		if (!w->ec || !w->rpi || !worker_resize(w)) {
+			worker_free(w);
+			break;
+		}
+
+		fips_reset(&w->fips);
+		if (pthread_create(&w->thread, NULL, worker_run, w)) {
+			worker_free(w);
+			break;
+		}
+
+		workers.n++;
+	}
+
+	if (workers.n < ncpu)
+		ERROR("only %u of %u boot workers started\n", workers.n, ncpu);
+
+	return workers.n;
+}
+
+/* totals of all workers since they were started */
+void workers_collect(struct workers_stats *ws)
+{
+	unsigned int i;
+
+	memset(ws, 0, sizeof(*ws));
+
+	for (i = 0; i < workers.n; i++) {
+		struct workers_stats *s = &workers.w[i].stats;
+
+		ws->injected_bytes += __atomic_load_n(&s->injected_bytes, __ATOMIC_RELAXED);
+		ws->credited_bits += __atomic_load_n(&s->credited_bits, __ATOMIC_RELAXED);
+		ws->ioctl_failures += __atomic_load_n(&s->ioctl_failures, __ATOMIC_RELAXED);
+		ws->read_failures += __atomic_load_n(&s->read_failures, __ATOMIC_RELAXED);
+		ws->fips_failures += __atomic_load_n(&s->fips_failures, __ATOMIC_RELAXED);
+	}
+}
+
+void workers_stop(void)
+{
+	unsigned int i;
+
+	__atomic_store_n(&workers.stop, true, __ATOMIC_RELAXED);
+
+	for (i = 0; i < workers.n; i++) {
+		pthread_join(workers.w[i].thread, NULL);
+		worker_free(&workers.w[i]);
+	}
+
+	workers.n = 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * Per-CPU collector threads for the boot phase.
+ *
+ * Distributed under the same terms as urngd.c, see there for details.
+ */
+
+#ifndef __WORKERS_H
+#define __WORKERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/random.h>
+
+#include "arena.h"
+
+#define WORKERS_MAX 16
+#define WORKER_BLOCK 64
+
+/* arena room and allocations of a worker with the default buffer */
+#define WORKER_ARENA \
+	(ARENA_COLLECTOR + ARENA_ROUND(sizeof(struct rand_pool_info) + WORKER_BLOCK))
+#define WORKER_ARENA_SLOTS 3
+
+struct sink;
+
+struct workers_stats {
+	uint64_t injected_bytes;
+	uint64_t credited_bits;
+	uint64_t ioctl_failures;
+	uint64_t read_failures;
+	uint64_t fips_failures;
+};
+
+void workers_reserve(size_t memsize);
+unsigned int workers_start(struct sink *sink, unsigned int osr,
+			   unsigned int credit, unsigned int fips_interval,
+			   unsigned int memblocks, unsigned int memblocksize);
+void workers_collect(struct workers_stats *ws);
+void workers_stop(void);
+
+#endif